@@ -0,0 +1,69 @@
+#ifndef TRACERING_ADAPTER_COUNTER_H
+#define TRACERING_ADAPTER_COUNTER_H
+
+#include "tracering/event.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // One TRACE_COUNTER / TRACE_GAUGE event
+    typedef struct
+    {
+        const char *name; // valid until tracer_adapter_counter_shutdown()
+        uint64_t timestamp;
+        double value; // counter: running total after this event, gauge: the value set
+        double delta; // counter: the increment, gauge: change from the previous value
+        uint32_t counter_id;   // see tracer_adapter_counter_series()
+        uint32_t kind;         // trace_value_kind_t
+        uint32_t thread_index; // registry index, resolve names with tracer_receiver_session_thread()
+        uint32_t session;      // session of the event, see tracer_receiver_session_name()
+    } trace_counter_sample_t;
+
+    // Samples downsampled to fixed time buckets, only buckets that got samples are kept
+    typedef struct
+    {
+        uint64_t start_timestamp; // multiple of bucket_ns
+        double min;
+        double max;
+        double last;
+        uint32_t samples;
+    } trace_counter_bucket_t;
+
+    typedef struct
+    {
+        const char *name;
+        uint32_t kind; // trace_value_kind_t
+        double value;  // latest value (running total for counters)
+        uint64_t samples;
+    } trace_counter_info_t;
+
+    typedef struct
+    {
+        uint64_t bucket_ns;    // width of a bucket
+        uint32_t bucket_count; // buckets kept per counter, the oldest are discarded
+    } tracer_counter_config_t;
+
+#define TRACER_COUNTER_CONFIG_DEFAULT {10000000, 1024} // 10ms buckets, about 10s of history
+
+    typedef void (*trace_counter_handler_t)(const trace_counter_sample_t *sample);
+
+    int tracer_adapter_counter_init(void); // init with TRACER_COUNTER_CONFIG_DEFAULT
+    int tracer_adapter_counter_init_config(const tracer_counter_config_t *config);
+    void tracer_adapter_counter_shutdown(void);
+    void tracer_adapter_counter_register_handler(trace_counter_handler_t handler);
+    void tracer_adapter_counter_unregister_handler(trace_counter_handler_t handler);
+
+    // Counters seen so far, ids go from 0 to count - 1
+    uint32_t tracer_adapter_counter_count(void);
+    int tracer_adapter_counter_info(uint32_t counter_id, trace_counter_info_t *info); // 0 on success, -1 if unknown
+
+    // Copies up to `max` of the counter's most recent buckets, oldest first, returns how many
+    uint32_t tracer_adapter_counter_series(uint32_t counter_id, trace_counter_bucket_t *buckets, uint32_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACERING_ADAPTER_COUNTER_H
@@ -0,0 +1,51 @@
+#ifndef TRACERING_ADAPTER_COUNTER_HPP
+#define TRACERING_ADAPTER_COUNTER_HPP
+
+#include "tracering/adapter/counter.h"
+#include "tracering/adapter/counter_ex.h"
+#include "tracering/internal/handler_overload.hpp"
+
+#include <vector>
+
+namespace tracering::adapter::counter
+{
+    struct CounterBinding
+        : public internal::HandlerRegistryBase<
+              trace_counter_handler_t,
+              trace_counter_handler_ex_t,
+              trace_counter_sample_t,
+              CounterBinding>
+    {
+        static void register_handler_ex(trace_counter_handler_ex_t fn, void *ctx)
+        {
+            tracer_adapter_counter_register_handler_ex(fn, ctx);
+        }
+
+        static void unregister_handler_ex(trace_counter_handler_ex_t fn, void *ctx)
+        {
+            tracer_adapter_counter_unregister_handler_ex(fn, ctx);
+        }
+    };
+
+    inline int init() { return tracer_adapter_counter_init(); }
+    inline int init(const tracer_counter_config_t &config) { return tracer_adapter_counter_init_config(&config); }
+    inline void shutdown() { tracer_adapter_counter_shutdown(); }
+    inline uint32_t count() { return tracer_adapter_counter_count(); }
+    inline bool info(uint32_t counter_id, trace_counter_info_t &info) { return tracer_adapter_counter_info(counter_id, &info) == 0; }
+    inline std::vector<trace_counter_bucket_t> series(uint32_t counter_id, uint32_t max)
+    {
+        std::vector<trace_counter_bucket_t> buckets(max);
+        buckets.resize(tracer_adapter_counter_series(counter_id, buckets.data(), max));
+        return buckets;
+    }
+
+    template <typename Handler>
+    inline void register_handler(Handler &&cb) { CounterBinding::register_handler(std::forward<Handler>(cb)); }
+
+    template <typename Handler>
+    inline void unregister_handler(Handler &&cb) { CounterBinding::unregister_handler(std::forward<Handler>(cb)); }
+    inline void unregister_handler_by_context(void *ctx) { CounterBinding::unregister_handler_by_context(ctx); }
+
+} // namespace tracering::adapter::counter
+
+#endif // TRACERING_ADAPTER_COUNTER_HPP
@@ -0,0 +1,22 @@
+#ifndef TRACERING_ADAPTER_COUNTER_EX_H
+#define TRACERING_ADAPTER_COUNTER_EX_H
+
+// Handlers with a context pointer, see stack_trace_ex.h
+
+#include "counter.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef void (*trace_counter_handler_ex_t)(const trace_counter_sample_t *sample, void *context);
+
+    void tracer_adapter_counter_register_handler_ex(trace_counter_handler_ex_t handler, void *context);
+    void tracer_adapter_counter_unregister_handler_ex(trace_counter_handler_ex_t handler, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACERING_ADAPTER_COUNTER_EX_H
@@ -0,0 +1,57 @@
+#ifndef TRACERING_ADAPTER_FLOW_H
+#define TRACERING_ADAPTER_FLOW_H
+
+#include "tracering/event.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // A piece of work followed from TRACE_FLOW_BEGIN to TRACE_FLOW_END. The earliest
+    // TRACE_FLOW_STEP marks where it started running, without steps the work is
+    // considered to start when it ends.
+    typedef struct
+    {
+        uint64_t id;
+        const char *begin_label; // labels stay valid until tracer_receiver_shutdown()
+        const char *start_label;
+        const char *end_label;
+        uint64_t begin_timestamp; // handed off
+        uint64_t start_timestamp; // first step
+        uint64_t end_timestamp;
+        uint64_t queue_ns; // start - begin, time spent waiting
+        uint64_t run_ns;   // end - start
+        uint32_t begin_thread_id; // OS thread ids and processes of the three sites
+        uint32_t begin_pid;
+        uint32_t start_thread_id;
+        uint32_t start_pid;
+        uint32_t end_thread_id;
+        uint32_t end_pid;
+        uint32_t steps;
+    } trace_flow_t;
+
+    typedef void (*trace_flow_handler_t)(const trace_flow_t *flow);
+
+    int tracer_adapter_flow_init(void);
+    void tracer_adapter_flow_shutdown(void);
+    void tracer_adapter_flow_register_handler(trace_flow_handler_t handler);
+    void tracer_adapter_flow_unregister_handler(trace_flow_handler_t handler);
+
+    // A finished flow is reported once none of its events came for 10ms of trace time,
+    // steps still in another thread's batch are counted in. This reports the finished
+    // flows still waiting, e.g. once the traced program has exited.
+    void tracer_adapter_flow_flush(void);
+
+    // Flows seen but not reported yet (waiting for their begin or end), and flows that
+    // could not be tracked because too many were pending, their id was reused early, or
+    // their begin never came within 10s. A flow whose end event was dropped stays pending.
+    // Flows are told apart by session and id.
+    uint32_t tracer_adapter_flow_pending(void);
+    uint64_t tracer_adapter_flow_lost(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACERING_ADAPTER_FLOW_H
@@ -0,0 +1,42 @@
+#ifndef TRACERING_ADAPTER_FLOW_HPP
+#define TRACERING_ADAPTER_FLOW_HPP
+
+#include "tracering/adapter/flow.h"
+#include "tracering/adapter/flow_ex.h"
+#include "tracering/internal/handler_overload.hpp"
+
+namespace tracering::adapter::flow
+{
+    struct FlowBinding
+        : public internal::HandlerRegistryBase<
+              trace_flow_handler_t,
+              trace_flow_handler_ex_t,
+              trace_flow_t,
+              FlowBinding>
+    {
+        static void register_handler_ex(trace_flow_handler_ex_t fn, void *ctx)
+        {
+            tracer_adapter_flow_register_handler_ex(fn, ctx);
+        }
+
+        static void unregister_handler_ex(trace_flow_handler_ex_t fn, void *ctx)
+        {
+            tracer_adapter_flow_unregister_handler_ex(fn, ctx);
+        }
+    };
+
+    inline int init() { return tracer_adapter_flow_init(); }
+    inline void shutdown() { tracer_adapter_flow_shutdown(); }
+    inline uint32_t pending() { return tracer_adapter_flow_pending(); }
+    inline uint64_t lost() { return tracer_adapter_flow_lost(); }
+
+    template <typename Handler>
+    inline void register_handler(Handler &&cb) { FlowBinding::register_handler(std::forward<Handler>(cb)); }
+
+    template <typename Handler>
+    inline void unregister_handler(Handler &&cb) { FlowBinding::unregister_handler(std::forward<Handler>(cb)); }
+    inline void unregister_handler_by_context(void *ctx) { FlowBinding::unregister_handler_by_context(ctx); }
+
+} // namespace tracering::adapter::flow
+
+#endif // TRACERING_ADAPTER_FLOW_HPP
@@ -0,0 +1,22 @@
+#ifndef TRACERING_ADAPTER_FLOW_EX_H
+#define TRACERING_ADAPTER_FLOW_EX_H
+
+// Handlers with a context pointer, see stack_trace_ex.h
+
+#include "flow.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef void (*trace_flow_handler_ex_t)(const trace_flow_t *flow, void *context);
+
+    void tracer_adapter_flow_register_handler_ex(trace_flow_handler_ex_t handler, void *context);
+    void tracer_adapter_flow_unregister_handler_ex(trace_flow_handler_ex_t handler, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACERING_ADAPTER_FLOW_EX_H
@@ -13,7 +13,11 @@ extern "C"
         char full_path[256]; // Full nested path "Trace1;Trace2;Trace3"
         uint64_t start_timestamp;
         uint64_t end_timestamp;
-        uint32_t thread_id;
+        uint32_t thread_id;    // OS thread id
+        uint32_t pid;          // emitting process
+        uint32_t thread_index; // registry index, resolve names with tracer_receiver_session_thread()
+        uint32_t session;      // session of the events, see tracer_receiver_session_name()
+        uint32_t weight;       // calls this span stands for (sampling), sum weight * duration for totals
     } trace_span_t;
 
     typedef void (*trace_span_handler_t)(const trace_span_t *span);
@@ -0,0 +1,97 @@
+#ifndef TRACERING_ARGS_H
+#define TRACERING_ARGS_H
+
+#include <stdint.h>
+
+#include "tracering/event.h"
+
+// Maps TRACE_ARGS arguments to a TRACE_ARG_* type code (a constant, usable in static
+// initializers) and to the raw value copied into the event.
+
+#ifdef __cplusplus
+#include <type_traits>
+
+template <typename T>
+constexpr char tracer_arg_type()
+{
+    static_assert(std::is_arithmetic_v<T> || std::is_pointer_v<T> || std::is_enum_v<T> || std::is_null_pointer_v<T>,
+                  "TRACE_ARGS only takes integers, floating point values and pointers");
+    if constexpr (std::is_floating_point_v<T>)
+        return TRACE_ARG_DOUBLE;
+    else if constexpr (std::is_pointer_v<T> || std::is_null_pointer_v<T>)
+        return TRACE_ARG_POINTER;
+    else if constexpr (std::is_enum_v<T>)
+        return std::is_signed_v<std::underlying_type_t<T>> ? TRACE_ARG_INT : TRACE_ARG_UINT;
+    else
+        return std::is_signed_v<T> ? TRACE_ARG_INT : TRACE_ARG_UINT;
+}
+
+template <typename T>
+inline trace_arg_t tracer_arg_value(T value)
+{
+    trace_arg_t arg;
+    constexpr char type = tracer_arg_type<T>();
+    if constexpr (type == TRACE_ARG_DOUBLE)
+        arg.f = (double)value;
+    else if constexpr (type == TRACE_ARG_POINTER)
+        arg.p = (uint64_t)(uintptr_t)value;
+    else if constexpr (type == TRACE_ARG_INT)
+        arg.i = (int64_t)value;
+    else
+        arg.u = (uint64_t)value;
+    return arg;
+}
+
+#define TRACE_ARG_TYPE(x) tracer_arg_type<std::decay_t<decltype(x)>>()
+#define TRACE_ARG_VALUE(x) tracer_arg_value(x)
+
+#else
+
+static inline trace_arg_t tracer_arg_int(int64_t value) { return (trace_arg_t){.i = value}; }
+static inline trace_arg_t tracer_arg_uint(uint64_t value) { return (trace_arg_t){.u = value}; }
+static inline trace_arg_t tracer_arg_double(double value) { return (trace_arg_t){.f = value}; }
+static inline trace_arg_t tracer_arg_pointer(const volatile void *value) { return (trace_arg_t){.p = (uint64_t)(uintptr_t)value}; }
+
+// Anything else (arrays and functions decay to pointers) is taken as a pointer, and
+// fails to compile if it isn't one
+#define TRACE_ARG_TYPE(x)                   \
+    _Generic((x),                           \
+        _Bool: TRACE_ARG_UINT,              \
+        char: TRACE_ARG_INT,                \
+        signed char: TRACE_ARG_INT,         \
+        short: TRACE_ARG_INT,               \
+        int: TRACE_ARG_INT,                 \
+        long: TRACE_ARG_INT,                \
+        long long: TRACE_ARG_INT,           \
+        unsigned char: TRACE_ARG_UINT,      \
+        unsigned short: TRACE_ARG_UINT,     \
+        unsigned int: TRACE_ARG_UINT,       \
+        unsigned long: TRACE_ARG_UINT,      \
+        unsigned long long: TRACE_ARG_UINT, \
+        float: TRACE_ARG_DOUBLE,            \
+        double: TRACE_ARG_DOUBLE,           \
+        long double: TRACE_ARG_DOUBLE,      \
+        default: TRACE_ARG_POINTER)
+
+#define TRACE_ARG_VALUE(x)                   \
+    _Generic((x),                            \
+        _Bool: tracer_arg_uint,              \
+        char: tracer_arg_int,                \
+        signed char: tracer_arg_int,         \
+        short: tracer_arg_int,               \
+        int: tracer_arg_int,                 \
+        long: tracer_arg_int,                \
+        long long: tracer_arg_int,           \
+        unsigned char: tracer_arg_uint,      \
+        unsigned short: tracer_arg_uint,     \
+        unsigned int: tracer_arg_uint,       \
+        unsigned long: tracer_arg_uint,      \
+        unsigned long long: tracer_arg_uint, \
+        float: tracer_arg_double,            \
+        double: tracer_arg_double,           \
+        long double: tracer_arg_double,      \
+        default: tracer_arg_pointer)(x)
+
+#endif
+
+#endif // TRACERING_ARGS_H
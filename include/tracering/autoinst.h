@@ -0,0 +1,38 @@
+#ifndef TRACERING_AUTOINST_H
+#define TRACERING_AUTOINST_H
+
+#include <stdint.h>
+
+// Automatic function instrumentation: code compiled with -finstrument-functions and
+// linked with libtracering-autoinst.a emits a BEGIN and an END event for every function
+// it enters and leaves, once tracer_emit_init() has been called. Events carry the
+// function's address relative to its module (one callsite per executable or shared
+// library), names are resolved by the receiver with tracer_receiver_symbol().
+
+#define TRACER_AUTOINST_MAX_DEPTH 256 // highest depth limit
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct
+    {
+        uint32_t max_depth;         // per thread, calls nested deeper emit nothing
+        const char *const *exclude; // function names not to trace, "prefix*" matches a prefix
+        uint32_t exclude_count;
+    } tracer_autoinst_config_t;
+
+#define TRACER_AUTOINST_CONFIG_DEFAULT {32, NULL, 0}
+
+    // Call before instrumented code runs on other threads, the names are copied. Names
+    // are looked up with dladdr(), which only sees exported symbols: link executables
+    // with -rdynamic to exclude their own functions. Functions called by an excluded one
+    // are still traced. Returns 0, -1 if the config is invalid.
+    int tracer_autoinst_config(const tracer_autoinst_config_t *config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACERING_AUTOINST_H
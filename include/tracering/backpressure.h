@@ -0,0 +1,15 @@
+#ifndef TRACER_BACKPRESSURE_H
+#define TRACER_BACKPRESSURE_H
+
+// What an emitter does when its ring is full. The policy is chosen by the receiver
+// (and can be changed while running), emitters pick it up from the shared segment.
+typedef enum
+{
+    TRACE_BACKPRESSURE_DROP = 0,  // drop the newest events, never blocks
+    TRACE_BACKPRESSURE_OVERWRITE, // overwrite the oldest unread events, never blocks
+    TRACE_BACKPRESSURE_SPIN,      // busy-wait for room up to the configured time, then drop
+    TRACE_BACKPRESSURE_YIELD,     // sched_yield() until there is room, lossless
+    TRACE_BACKPRESSURE_BLOCK,     // sleep on a futex until the receiver frees room, lossless
+} trace_backpressure_t;
+
+#endif // TRACER_BACKPRESSURE_H
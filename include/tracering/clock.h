@@ -0,0 +1,17 @@
+#ifndef TRACER_CLOCK_H
+#define TRACER_CLOCK_H
+
+#include <stdint.h>
+
+// Clock used by emitters to timestamp events. The source is chosen by the receiver
+// when it creates the shared segment, emitters pick it up in tracer_emit_init().
+// Timestamps are always delivered to receiver handlers in nanoseconds.
+typedef enum
+{
+    TRACE_CLOCK_MONOTONIC = 0,    // clock_gettime(CLOCK_MONOTONIC)
+    TRACE_CLOCK_MONOTONIC_COARSE, // clock_gettime(CLOCK_MONOTONIC_COARSE), cheaper, jiffy resolution
+    TRACE_CLOCK_TSC,              // raw rdtsc, converted to ns by the receiver using a calibration record
+    TRACE_CLOCK_MANUAL,           // set/advanced explicitly with tracer_clock_set(), for deterministic tests
+} trace_clock_source_t;
+
+#endif // TRACER_CLOCK_H
@@ -1,23 +1,164 @@
 #ifndef TRACER_EMIT_H
 #define TRACER_EMIT_H
 
-#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 #include <time.h>
 
+#include "tracering/args.h"
+#include "tracering/clock.h"
 #include "tracering/event.h"
+#include "tracering/mapping.h"
 #include "tracering/macro_utils.h"
 
+#define TRACER_BATCH_MAX 64 // maximum number of events staged per thread
+#define TRACER_HOLD_MAX 32  // nested scopes held back per thread by the minimum duration filter
+
+#ifdef __cplusplus
+#define TRACE_THREAD_LOCAL thread_local
+#else
+#define TRACE_THREAD_LOCAL _Thread_local
+#endif
+
+#ifdef __cplusplus
+#define TRACE_STATIC_ASSERT(cond, message) static_assert(cond, message)
+#else
+#define TRACE_STATIC_ASSERT(cond, message) _Static_assert(cond, message)
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-    int tracer_emit_init(void);
+    typedef struct
+    {
+        unsigned int map_flags; // TRACE_MAP_* options for this process's mapping of the segment
+        const char *session;    // session to join, NULL: $TRACERING_SESSION or the default session
+
+        // Flight recorder, used when the session has no receiver: events go to rings in
+        // this process's memory, the oldest being overwritten, and are written to a file
+        // by tracer_flight_dump(), on `flight_signal` and on SIGSEGV, SIGBUS, SIGILL, SIGFPE
+        // and SIGABRT. Read the file with tracer_receiver_add_dump().
+        uint32_t flight_capacity; // 8-byte units kept per ring (16 rings), 0: init fails without a receiver
+        const char *flight_path;  // NULL: "tracering-<pid>.flight" in the working directory
+        int flight_signal;        // e.g. SIGUSR2, 0 for none
+
+        // Minimum duration filter: a TRACE scope's begin event is held back until the scope
+        // ends, and both events are left out if it lasted less than this (counted as
+        // filtered). Emitting anything inside the scope publishes it. TRACE_COMPLETE scopes
+        // are filtered the same way.
+        uint64_t min_duration_ns; // 0 keeps every scope
+    } tracer_emit_config_t;
+
+#define TRACER_EMIT_CONFIG_DEFAULT {TRACE_MAP_DEFAULT, NULL, 0, NULL, 0, 0}
+
+    int tracer_emit_init(void); // init with TRACER_EMIT_CONFIG_DEFAULT
+    int tracer_emit_init_config(const tracer_emit_config_t *config);
     void tracer_emit_shutdown(void);
 
-    void tracer_set(trace_event_t *event);        // sets the timestamp and thread ID
+    // TRACE_MAP_* options obtained for this process's mapping, see tracering/mapping.h
+    unsigned int tracer_emit_mapping(void);
+
+    // Nonzero if events go to the flight recorder instead of a receiver
+    int tracer_emit_flight(void);
+
+    // Publishes the calling thread's staged events and writes the flight recorder to `path`
+    // (NULL: the configured one) through a temporary file. Returns 0, -1 if there is no
+    // flight recorder, the file can't be written or a dump is already in progress.
+    int tracer_flight_dump(const char *path);
+
+    // set the timestamp, thread index, sample weight, kind and depth, no arguments
+    void tracer_set(trace_event_t *event); // TRACE_EVENT_INSTANT
+    void tracer_set_kind(trace_event_t *event, trace_event_kind_t kind);
     void tracer_emit(const trace_event_t *event); // will add a copy of the event to the trace buffer
 
+    // adds copies of `count` events to the trace buffer using a single reservation
+    void tracer_emit_list(const trace_event_t *events, unsigned int count);
+
+    // adds a copy of the event followed by `size` bytes of `data`, truncated to the
+    // receiver's payload_max, as one record (see TRACE_DATA)
+    void tracer_emit_payload(const trace_event_t *event, const void *data, uint32_t size);
+
+    // emit the opening/closing event of a TRACE scope, the outermost scope exit flushes staged events
+    void tracer_emit_begin(const trace_event_t *event);
+    void tracer_emit_end(const trace_event_t *event);
+
+    // TRACE_COMPLETE: begin sets the event and opens the scope, end sets the duration,
+    // closes the scope and emits the one event
+    void tracer_complete_begin(trace_event_t *event);
+    void tracer_complete_end(trace_event_t *event);
+
+    // Batching (opt-in, per thread): events are staged in a thread-local buffer and
+    // published together once `batch_size` events are staged, when the outermost TRACE
+    // scope exits, on tracer_flush() and on thread exit. 0 or 1 disables batching.
+    void tracer_emit_set_batch_size(unsigned int batch_size);
+    void tracer_flush(void); // publishes this thread's staged events
+
+    // TRACE_CLOCK_MANUAL: sets/advances the clock shared by all emitters of the segment
+    void tracer_clock_set(uint64_t ns);
+    void tracer_clock_advance(uint64_t ns);
+
+    // registers the callsite's label, file, line and function in the shared string table
+    // (once per callsite), returns its id
+    uint32_t tracer_callsite_register(trace_callsite_t *callsite);
+
+    static inline uint32_t tracer_callsite_id(trace_callsite_t *callsite)
+    {
+        uint32_t id = __atomic_load_n(&callsite->id, __ATOMIC_ACQUIRE);
+        return id ? id : tracer_callsite_register(callsite);
+    }
+
+    // Interns a label built at runtime (per tenant, per request type...) as a callsite of its
+    // own: the first call for a string registers it, later ones from any thread or process
+    // of the session find it in a lock-free hash table in the segment. Returns the callsite
+    // id to pass to TRACE_INTERNED / TRACE_NOTIFY_INTERNED, keep it to skip the lookup.
+    uint32_t tracer_intern(const char *label);
+
+    // Sampling: a sampled scope is kept once every `n` runs per thread and its events carry
+    // weight n. Events emitted inside it are multiplied by n as well, and suppressed when the
+    // scope is skipped, so nested paths stay consistent and weighted sums stay unbiased.
+    // tracer_sample_begin() returns the previous multiplier to pass to tracer_sample_end().
+    uint32_t tracer_sample_begin(uint32_t weight); // 0 suppresses events until tracer_sample_end()
+    void tracer_sample_end(uint32_t previous);
+
+    // 1 in 1, 4, 16 or 64 as this thread's ring goes past 1/2, 3/4 and 7/8 full
+    uint32_t tracer_sample_adaptive_rate(void);
+
+    // Per-callsite 1-in-n decision, returns the weight of a kept run or 0. Runs inside a
+    // sampled-out scope don't count, so nested sites aren't in lockstep with the outer one.
+    uint32_t tracer_sample(uint32_t *counter, uint32_t n);
+
+    // Runtime filtering: the receiver sets an enable mask in the shared segment, every
+    // TRACE* macro checks it with one relaxed load before doing anything else.
+
+    typedef struct trace_category
+    {
+        const char *name;
+        uint64_t bits;               // mask bits of the category, 0 until first used or after shutdown
+        struct trace_category *next; // emitter's list of registered categories
+    } trace_category_t;
+
+    extern uint64_t *tracer_enable_mask; // the segment's enable mask, reads as 0 when not attached
+
+    // looks up (or adds) the category in the shared category table, returns its mask bits
+    uint64_t tracer_category_register(trace_category_t *category);
+
+    static inline int tracer_enabled(void)
+    {
+        const uint64_t bits = TRACE_MASK_ENABLED | TRACE_MASK_UNCATEGORIZED;
+        return (__atomic_load_n(tracer_enable_mask, __ATOMIC_RELAXED) & bits) == bits;
+    }
+
+    static inline int tracer_category_enabled(trace_category_t *category)
+    {
+        uint64_t mask = __atomic_load_n(tracer_enable_mask, __ATOMIC_RELAXED);
+        if (!(mask & TRACE_MASK_ENABLED))
+            return 0;
+        uint64_t bits = __atomic_load_n(&category->bits, __ATOMIC_RELAXED);
+        return (mask & (bits ? bits : tracer_category_register(category))) != 0;
+    }
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,51 +166,266 @@ extern "C"
 #define _STRINGIFY(x) #x
 #define STRINGIFY(x) _STRINGIFY(x)
 
-#define TRACE_NOTIFY(label)                                                    \
-    do                                                                         \
-    {                                                                          \
-        trace_event_t event;                                                   \
-        tracer_set(&event);                                                    \
-        snprintf(event.data, TRACE_EVENT_PAYLOAD_MAX, "%s", STRINGIFY(label)); \
-        tracer_emit(&event);                                                   \
+// static callsite descriptor initializer for a label at the current source location
+#define TRACE_CALLSITE_INIT(label) {STRINGIFY(label), __FILE__, __func__, __LINE__, 0, 0, 0, 0, 0}
+#define TRACE_CALLSITE_ARGS_INIT(label, fmt, arg_types) {STRINGIFY(label), __FILE__, __func__, __LINE__, fmt, arg_types, 0, 0, 0}
+#define TRACE_CALLSITE_VALUE_INIT(name, kind, arg_types) {STRINGIFY(name), __FILE__, __func__, __LINE__, 0, arg_types, kind, 0, 0}
+
+// static category descriptor initializer, the category is registered on first use
+#define TRACE_CATEGORY_INIT(category) {STRINGIFY(category), 0, 0}
+
+#define _TRACE_NOTIFY_IF(enabled, label)                                           \
+    do                                                                             \
+    {                                                                              \
+        if (enabled)                                                               \
+        {                                                                          \
+            static trace_callsite_t _tracer_callsite = TRACE_CALLSITE_INIT(label); \
+            trace_event_t event;                                                   \
+            tracer_set(&event);                                                    \
+            event.callsite_id = tracer_callsite_id(&_tracer_callsite);             \
+            tracer_emit(&event);                                                   \
+        }                                                                          \
+    } while (0)
+
+#define TRACE_NOTIFY(label) _TRACE_NOTIFY_IF(tracer_enabled(), label)
+
+#define TRACE_NOTIFY_CAT(category, label)                                         \
+    do                                                                            \
+    {                                                                             \
+        static trace_category_t _tracer_category = TRACE_CATEGORY_INIT(category); \
+        _TRACE_NOTIFY_IF(tracer_category_enabled(&_tracer_category), label);      \
     } while (0)
 
 // call tracer_emit for multiple labels, all traces share the same timestamp and thread ID,
 // but the order of the labels is preserved in the trace buffer
-#define TRACE_NOTIFY_LIST(...)                                              \
-    do                                                                      \
-    {                                                                       \
-        trace_event_t event;                                                \
-        tracer_set(&event);                                                 \
-        const char *labels[] = {MAP_STRINGIFY(__VA_ARGS__)};                \
-        for (size_t i = 0; i < sizeof(labels) / sizeof(labels[0]); ++i)     \
-        {                                                                   \
-            snprintf(event.data, TRACE_EVENT_PAYLOAD_MAX, "%s", labels[i]); \
-            tracer_emit(&event);                                            \
-        }                                                                   \
+#define TRACE_NOTIFY_LIST(...)                                                                 \
+    do                                                                                         \
+    {                                                                                          \
+        if (!tracer_enabled())                                                                 \
+            break;                                                                             \
+        static trace_callsite_t _tracer_callsites[] = {MAP(TRACE_CALLSITE_INIT, __VA_ARGS__)}; \
+        trace_event_t events[sizeof(_tracer_callsites) / sizeof(_tracer_callsites[0])];        \
+        tracer_set(&events[0]);                                                                \
+        for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); ++i)                        \
+        {                                                                                      \
+            events[i].timestamp = events[0].timestamp;                                         \
+            events[i].thread_index = events[0].thread_index;                                   \
+            events[i].weight = events[0].weight;                                               \
+            events[i].arg_count = 0;                                                           \
+            events[i].kind = TRACE_EVENT_INSTANT;                                              \
+            events[i].depth = events[0].depth;                                                 \
+            events[i].callsite_id = tracer_callsite_id(&_tracer_callsites[i]);                 \
+        }                                                                                      \
+        tracer_emit_list(events, sizeof(events) / sizeof(events[0]));                          \
+    } while (0)
+
+// The enable check is made once per scope, so the end event is emitted if and only
+// if the begin event was, even if the mask changes while the body runs
+#define _TRACE_SCOPE_IF(enabled, label, ...)                                   \
+    do                                                                         \
+    {                                                                          \
+        static trace_callsite_t _tracer_callsite = TRACE_CALLSITE_INIT(label); \
+        int _tracer_enabled = (enabled);                                       \
+        trace_event_t event;                                                   \
+        if (_tracer_enabled)                                                   \
+        {                                                                      \
+            event.callsite_id = tracer_callsite_id(&_tracer_callsite);         \
+            tracer_set_kind(&event, TRACE_EVENT_BEGIN);                        \
+            tracer_emit_begin(&event);                                         \
+        }                                                                      \
+        __VA_ARGS__;                                                           \
+        if (_tracer_enabled)                                                   \
+        {                                                                      \
+            tracer_set_kind(&event, TRACE_EVENT_END);                          \
+            tracer_emit_end(&event);                                           \
+        }                                                                      \
     } while (0)
 
-#define TRACE(label, body)                                                     \
+#define TRACE(label, ...) _TRACE_SCOPE_IF(tracer_enabled(), label, __VA_ARGS__)
+
+// Like TRACE, but a single TRACE_EVENT_COMPLETE event carrying the duration is emitted
+// when the scope exits: half the events for short scopes. It comes after the events
+// emitted inside it, so the stack trace adapter shows it as "?" in their paths: best
+// used for leaf scopes.
+#define TRACE_COMPLETE(label, ...)                                             \
     do                                                                         \
     {                                                                          \
+        static trace_callsite_t _tracer_callsite = TRACE_CALLSITE_INIT(label); \
+        int _tracer_enabled = tracer_enabled();                                \
         trace_event_t event;                                                   \
-        snprintf(event.data, TRACE_EVENT_PAYLOAD_MAX, "%s", STRINGIFY(label)); \
-        tracer_set(&event);                                                    \
-        tracer_emit(&event);                                                   \
-        body;                                                                  \
-        tracer_set(&event);                                                    \
-        tracer_emit(&event);                                                   \
+        if (_tracer_enabled)                                                   \
+        {                                                                      \
+            event.callsite_id = tracer_callsite_id(&_tracer_callsite);         \
+            tracer_complete_begin(&event);                                     \
+        }                                                                      \
+        __VA_ARGS__;                                                           \
+        if (_tracer_enabled)                                                   \
+            tracer_complete_end(&event);                                       \
     } while (0)
 
+#define TRACE_CAT(category, label, ...)                                                  \
+    do                                                                                   \
+    {                                                                                    \
+        static trace_category_t _tracer_category = TRACE_CATEGORY_INIT(category);        \
+        _TRACE_SCOPE_IF(tracer_category_enabled(&_tracer_category), label, __VA_ARGS__); \
+    } while (0)
+
+// TRACE_NOTIFY and TRACE with a label interned by tracer_intern()
+#define TRACE_NOTIFY_INTERNED(handle)                      \
+    do                                                     \
+    {                                                      \
+        if (tracer_enabled())                              \
+        {                                                  \
+            trace_event_t event;                           \
+            tracer_set(&event);                            \
+            event.callsite_id = (handle);                  \
+            tracer_emit(&event);                           \
+        }                                                  \
+    } while (0)
+
+#define TRACE_INTERNED(handle, ...)                        \
+    do                                                     \
+    {                                                      \
+        int _tracer_enabled = tracer_enabled();            \
+        trace_event_t event;                               \
+        if (_tracer_enabled)                               \
+        {                                                  \
+            event.callsite_id = (handle);                  \
+            tracer_set_kind(&event, TRACE_EVENT_BEGIN);    \
+            tracer_emit_begin(&event);                     \
+        }                                                  \
+        __VA_ARGS__;                                       \
+        if (_tracer_enabled)                               \
+        {                                                  \
+            tracer_set_kind(&event, TRACE_EVENT_END);      \
+            tracer_emit_end(&event);                       \
+        }                                                  \
+    } while (0)
+
+#define _TRACE_SAMPLED(label, rate, ...)                                                               \
+    do                                                                                                 \
+    {                                                                                                  \
+        static TRACE_THREAD_LOCAL uint32_t _tracer_sample_count = 0;                                   \
+        int _tracer_sampling = tracer_enabled();                                                       \
+        uint32_t _tracer_weight = _tracer_sampling ? tracer_sample(&_tracer_sample_count, (rate)) : 0; \
+        uint32_t _tracer_previous = _tracer_sampling ? tracer_sample_begin(_tracer_weight) : 0;        \
+        _TRACE_SCOPE_IF(_tracer_weight != 0, label, __VA_ARGS__);                                      \
+        if (_tracer_sampling)                                                                          \
+            tracer_sample_end(_tracer_previous);                                                       \
+    } while (0)
+
+#define _TRACE_NOTIFY_SAMPLED(label, rate)                                                            \
+    do                                                                                                \
+    {                                                                                                 \
+        static TRACE_THREAD_LOCAL uint32_t _tracer_sample_count = 0;                                  \
+        uint32_t _tracer_weight;                                                                      \
+        if (tracer_enabled() && (_tracer_weight = tracer_sample(&_tracer_sample_count, (rate))) != 0) \
+        {                                                                                             \
+            uint32_t _tracer_previous = tracer_sample_begin(_tracer_weight);                          \
+            _TRACE_NOTIFY_IF(1, label);                                                               \
+            tracer_sample_end(_tracer_previous);                                                      \
+        }                                                                                             \
+    } while (0)
+
+// keep 1 in n runs of the scope (per thread), each kept run stands for n
+#define TRACE_SAMPLED(label, n, ...) _TRACE_SAMPLED(label, n, __VA_ARGS__)
+#define TRACE_NOTIFY_SAMPLED(label, n) _TRACE_NOTIFY_SAMPLED(label, n)
+
+// sample only as much as needed to keep up, see tracer_sample_adaptive_rate()
+#define TRACE_SAMPLED_ADAPTIVE(label, ...) _TRACE_SAMPLED(label, tracer_sample_adaptive_rate(), __VA_ARGS__)
+#define TRACE_NOTIFY_SAMPLED_ADAPTIVE(label) _TRACE_NOTIFY_SAMPLED(label, tracer_sample_adaptive_rate())
+
+// Instant event carrying up to TRACE_ARGS_MAX integers, floating point values or pointers.
+// Only the raw values are copied, the printf-style `fmt` is registered once with the
+// callsite and the receiver formats it on demand, see tracer_receiver_format().
+#define TRACE_ARGS(label, fmt, ...)                                                                                   \
+    do                                                                                                                \
+    {                                                                                                                 \
+        if (!tracer_enabled())                                                                                        \
+            break;                                                                                                    \
+        static const char _tracer_arg_types[] = {MAP(TRACE_ARG_TYPE, __VA_ARGS__), '\0'};                             \
+        static trace_callsite_t _tracer_callsite = TRACE_CALLSITE_ARGS_INIT(label, fmt, _tracer_arg_types);           \
+        const trace_arg_t _tracer_args[] = {MAP(TRACE_ARG_VALUE, __VA_ARGS__)};                                       \
+        TRACE_STATIC_ASSERT(sizeof(_tracer_args) / sizeof(_tracer_args[0]) <= TRACE_ARGS_MAX, "too many TRACE_ARGS"); \
+        trace_event_t event;                                                                                          \
+        tracer_set(&event);                                                                                           \
+        event.callsite_id = tracer_callsite_id(&_tracer_callsite);                                                    \
+        event.arg_count = sizeof(_tracer_args) / sizeof(_tracer_args[0]);                                             \
+        for (uint32_t i = 0; i < event.arg_count; ++i)                                                                \
+            event.args[i] = _tracer_args[i];                                                                          \
+        tracer_emit(&event);                                                                                          \
+    } while (0)
+
+#define _TRACE_VALUE(name, kind, value)                                                                      \
+    do                                                                                                       \
+    {                                                                                                        \
+        if (!tracer_enabled())                                                                               \
+            break;                                                                                           \
+        static const char _tracer_arg_types[] = {TRACE_ARG_TYPE(value), '\0'};                               \
+        static trace_callsite_t _tracer_callsite = TRACE_CALLSITE_VALUE_INIT(name, kind, _tracer_arg_types); \
+        const trace_arg_t _tracer_value = TRACE_ARG_VALUE(value); /* before the timestamp is taken */        \
+        trace_event_t event;                                                                                 \
+        tracer_set(&event);                                                                                  \
+        event.callsite_id = tracer_callsite_id(&_tracer_callsite);                                           \
+        event.arg_count = 1;                                                                                 \
+        event.args[0] = _tracer_value;                                                                       \
+        tracer_emit(&event);                                                                                 \
+    } while (0)
+
+// Instant event carrying a copy of `size` bytes at `data` (a query, a packet header...),
+// read by handlers with tracer_receiver_payload(). The payload is part of the event's
+// record, one ring unit per 8 bytes, up to the receiver's payload_max.
+#define TRACE_DATA(label, data, size)                                              \
+    do                                                                             \
+    {                                                                              \
+        if (!tracer_enabled())                                                     \
+            break;                                                                 \
+        static trace_callsite_t _tracer_callsite = TRACE_CALLSITE_INIT(label);     \
+        trace_event_t event;                                                       \
+        tracer_set(&event);                                                        \
+        event.callsite_id = tracer_callsite_id(&_tracer_callsite);                 \
+        tracer_emit_payload(&event, (data), (uint32_t)(size));                     \
+    } while (0)
+
+// TRACE_DATA of a string, without its terminator
+#define TRACE_STRING(label, str)                                                   \
+    do                                                                             \
+    {                                                                              \
+        if (!tracer_enabled())                                                     \
+            break;                                                                 \
+        const char *_tracer_string = (str);                                        \
+        TRACE_DATA(label, _tracer_string, strlen(_tracer_string));                 \
+    } while (0)
+
+// Numeric time series on the same timeline as the other events, callsites with the same
+// name feed the same series (see tracering/adapter/counter.h)
+#define TRACE_COUNTER(name, delta) _TRACE_VALUE(name, TRACE_VALUE_COUNTER, delta) // cache hits, bytes sent
+#define TRACE_GAUGE(name, value) _TRACE_VALUE(name, TRACE_VALUE_GAUGE, value)     // queue depth, pool occupancy
+
+// Work that hops threads: the same `id` (any integer or pointer unique while the work is
+// in flight) links the site that hands the work off to the sites that pick it up and
+// finish it, on any thread or process (see tracering/adapter/flow.h)
+#define TRACE_FLOW_BEGIN(label, id) _TRACE_VALUE(label, TRACE_VALUE_FLOW_BEGIN, id)
+#define TRACE_FLOW_STEP(label, id) _TRACE_VALUE(label, TRACE_VALUE_FLOW_STEP, id)
+#define TRACE_FLOW_END(label, id) _TRACE_VALUE(label, TRACE_VALUE_FLOW_END, id)
+
 #ifndef NDEBUG
 #define TRACE_NOTIFY_DEBUG(label) TRACE_NOTIFY(label)
 #define TRACE_NOTIFY_LIST_DEBUG(...) TRACE_NOTIFY_LIST(__VA_ARGS__)
-#define TRACE_DEBUG(label, body) TRACE(label, body)
+#define TRACE_ARGS_DEBUG(label, fmt, ...) TRACE_ARGS(label, fmt, __VA_ARGS__)
+#define TRACE_COMPLETE_DEBUG(label, ...) TRACE_COMPLETE(label, __VA_ARGS__)
+#define TRACE_DEBUG(label, ...) TRACE(label, __VA_ARGS__)
+#define TRACE_NOTIFY_CAT_DEBUG(category, label) TRACE_NOTIFY_CAT(category, label)
+#define TRACE_CAT_DEBUG(category, label, ...) TRACE_CAT(category, label, __VA_ARGS__)
 
 #else
 #define TRACE_NOTIFY_DEBUG(label)
 #define TRACE_NOTIFY_LIST_DEBUG(...)
-#define TRACE_DEBUG(label, body) body // TRACE_DEBUG does not emit anything in release builds, but still runs the body
+#define TRACE_ARGS_DEBUG(label, fmt, ...)
+#define TRACE_COMPLETE_DEBUG(label, ...) __VA_ARGS__
+#define TRACE_DEBUG(label, ...) __VA_ARGS__ // TRACE_DEBUG does not emit anything in release builds, but still runs the body
+#define TRACE_NOTIFY_CAT_DEBUG(category, label)
+#define TRACE_CAT_DEBUG(category, label, ...) __VA_ARGS__
 
 #endif // NDEBUG
 
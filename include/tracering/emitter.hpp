@@ -3,4 +3,119 @@
 
 #include "tracering/emitter.h"
 
+#include <cstddef>
+#include <cstdint>
+
+#if __cplusplus >= 202002L && __has_include(<source_location>)
+#include <source_location>
+#endif
+
+namespace tracering
+{
+#if defined(__cpp_lib_source_location)
+    using source_location = std::source_location;
+#else
+    // C++17 stand-in, same builtins std::source_location is implemented with
+    struct source_location
+    {
+        static constexpr source_location current(const char *file = __builtin_FILE(),
+                                                 const char *function = __builtin_FUNCTION(),
+                                                 std::uint_least32_t line = __builtin_LINE()) noexcept
+        {
+            return source_location{file, function, line};
+        }
+
+        constexpr const char *file_name() const noexcept { return file_; }
+        constexpr const char *function_name() const noexcept { return function_; }
+        constexpr std::uint_least32_t line() const noexcept { return line_; }
+
+        const char *file_;
+        const char *function_;
+        std::uint_least32_t line_;
+    };
+#endif
+
+    // A label as a type: "Parse"_trace is a Label<'P', 'a', 'r', 's', 'e'>
+    template <char... Chars>
+    struct Label
+    {
+        static constexpr char value[] = {Chars..., '\0'};
+        static_assert(sizeof...(Chars) > 0, "empty trace label");
+    };
+
+    namespace literals
+    {
+        // String literal operator template, a GNU extension supported by GCC and Clang
+        template <typename Char, Char... Chars>
+        constexpr Label<Chars...> operator""_trace() noexcept { return {}; }
+    }
+
+    namespace detail
+    {
+        // Callsite of a TRACERING_SCOPE, built at compile time from the label and the
+        // location of the macro
+        template <typename L>
+        constexpr trace_callsite_t callsite(L, const source_location &location) noexcept
+        {
+            return trace_callsite_t{L::value, location.file_name(), location.function_name(), location.line(), nullptr, nullptr, 0, 0, nullptr};
+        }
+    }
+
+    // TRACE scope as an RAII object, it ends wherever the enclosing block is left
+    // (returns, exceptions) and the body needs no restructuring. Each use site needs a
+    // callsite of its own, TRACERING_SCOPE declares both:
+    //
+    //   using namespace tracering::literals;
+    //   TRACERING_SCOPE("Parse"_trace);
+    //
+    // While tracing is disabled the constructor and destructor are one predicted-not-taken
+    // branch each.
+    class Scope
+    {
+    public:
+        explicit Scope(trace_callsite_t &callsite) noexcept
+        {
+            if (__builtin_expect(tracer_enabled(), 0))
+                begin(callsite);
+        }
+
+        ~Scope()
+        {
+            if (__builtin_expect(active_, 0))
+                end();
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        void begin(trace_callsite_t &callsite) noexcept
+        {
+            event_.callsite_id = tracer_callsite_id(&callsite);
+            tracer_set_kind(&event_, TRACE_EVENT_BEGIN);
+            tracer_emit_begin(&event_);
+            active_ = true;
+        }
+
+        void end() noexcept
+        {
+            tracer_set_kind(&event_, TRACE_EVENT_END);
+            tracer_emit_end(&event_);
+        }
+
+        bool active_ = false;
+        trace_event_t event_;
+    };
+}
+
+#define _TRACERING_CONCAT(a, b) a##b
+#define _TRACERING_NAME(name, line) _TRACERING_CONCAT(name, line)
+
+// Scope lasting until the end of the enclosing block, with a static callsite for this
+// line: at most one per line.
+#define TRACERING_SCOPE(label)                                                         \
+    static trace_callsite_t _TRACERING_NAME(_tracer_callsite_, __LINE__) =             \
+        ::tracering::detail::callsite(label, ::tracering::source_location::current()); \
+    ::tracering::Scope _TRACERING_NAME(_tracer_scope_, __LINE__)(_TRACERING_NAME(_tracer_callsite_, __LINE__))
+
 #endif // TRACERING_EMITTER_HPP
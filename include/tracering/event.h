@@ -3,12 +3,100 @@
 
 #include <stdint.h>
 
-#define TRACE_EVENT_PAYLOAD_MAX 52
+#define TRACE_ARGS_MAX 4 // arguments per TRACE_ARGS event
+#define TRACE_PAYLOAD_MAX (64 * 1024) // bytes of payload per TRACE_DATA event
+
+// Argument type codes, one per argument in trace_callsite_t::arg_types
+#define TRACE_ARG_INT 'i'     // signed integers, widened to int64_t
+#define TRACE_ARG_UINT 'u'    // unsigned integers and bool, widened to uint64_t
+#define TRACE_ARG_DOUBLE 'f'  // float and double
+#define TRACE_ARG_POINTER 'p' // pointers, the address only (strings are not copied)
+
+// Raw argument value, which member is valid depends on the callsite's type code
+typedef union
+{
+    int64_t i;
+    uint64_t u;
+    double f;
+    uint64_t p;
+} trace_arg_t;
+
+// Set by the macros, consumers pair BEGIN and END events by depth instead of guessing
+typedef enum
+{
+    TRACE_EVENT_INSTANT = 0, // TRACE_NOTIFY, TRACE_ARGS, counters, flows
+    TRACE_EVENT_BEGIN,       // TRACE scope entered
+    TRACE_EVENT_END,         // TRACE scope exited, same depth as its BEGIN
+    TRACE_EVENT_COMPLETE,    // TRACE_COMPLETE scope, timestamp is its start
+    TRACE_EVENT_GAP,         // from the receiver: up to args[0].u events of the thread, args[1].u
+                             // ring units, were overwritten unread (TRACE_BACKPRESSURE_OVERWRITE),
+                             // TRACE_THREAD_NONE: any thread without its own ring. No callsite,
+                             // timestamp of the next event.
+} trace_event_kind_t;
+
 typedef struct
 {
     uint64_t timestamp;
-    uint32_t thread_id;
-    char data[TRACE_EVENT_PAYLOAD_MAX]; // label string
+    uint16_t thread_index; // registered thread, see tracer_receiver_event_thread()
+    uint16_t session;      // receiver's index of the session the event came from, 0 if only one
+    uint32_t callsite_id;  // registered callsite, see tracer_receiver_event_callsite()
+    uint32_t weight;       // occurrences this event stands for, > 1 for sampled events
+    uint8_t arg_count;     // valid entries of args, TRACE_ARGS events only
+    uint8_t kind;          // trace_event_kind_t
+    uint16_t depth;        // TRACE scopes open on the thread, not counting this one
+
+    // Optional part: ring records only carry the arguments actually present, or the
+    // duration, after the 24 bytes above
+    union
+    {
+        trace_arg_t args[TRACE_ARGS_MAX];
+        uint64_t duration; // TRACE_EVENT_COMPLETE events
+    };
 } trace_event_t;
 
-#endif // TRACE_EVENT_H
\ No newline at end of file
+// Callsites of TRACE_COUNTER / TRACE_GAUGE / TRACE_FLOW_* and instrumented modules,
+// their events carry a single value in args[0]
+typedef enum
+{
+    TRACE_VALUE_NONE = 0,   // not a value callsite
+    TRACE_VALUE_COUNTER,    // the value is added to a running total
+    TRACE_VALUE_GAUGE,      // the value replaces the previous one
+    TRACE_VALUE_FLOW_BEGIN, // the value is a flow's correlation id: work handed off
+    TRACE_VALUE_FLOW_STEP,  // picked up (possibly on another thread)
+    TRACE_VALUE_FLOW_END,   // finished
+    TRACE_VALUE_FUNCTION,   // -finstrument-functions: the value is a function's address relative to
+                            // the module named by the label, see tracer_receiver_symbol()
+} trace_value_kind_t;
+
+// Static description of a trace callsite. Each callsite registers once into the
+// shared string table, after which events only carry its id. The emitter clears the
+// ids of the callsites it registered at shutdown, they belong to that segment.
+typedef struct trace_callsite
+{
+    const char *label;
+    const char *file;
+    const char *function;
+    uint32_t line;
+    const char *format;          // TRACE_ARGS printf-style format, NULL for other callsites
+    const char *arg_types;       // TRACE_ARG_* code of each argument (TRACE_ARGS, TRACE_COUNTER, TRACE_GAUGE)
+    uint32_t value_kind;         // trace_value_kind_t
+    uint32_t id;                 // 0 until registered
+    struct trace_callsite *next; // emitter's list of registered callsites
+} trace_callsite_t;
+
+// Emitters and a receiver meet in a named session, each has its own segment. Without a
+// name (NULL) the TRACERING_SESSION environment variable is used, then the default session.
+#define TRACE_SESSION_ENV "TRACERING_SESSION"
+#define TRACE_SESSION_NAME_MAX 32 // including the terminator, letters, digits, '_', '-' and '.'
+#define TRACE_SESSION_MAX 8       // sessions one receiver can attach to
+
+#define TRACE_THREAD_NONE 0u // thread could not be registered (emitter not initialized, registry full)
+
+#define TRACE_CALLSITE_NONE 0u               // no callsite (emitter not initialized)
+#define TRACE_CALLSITE_OVERFLOW 0xFFFFFFFFu // registry was full, resolves to an unknown label
+
+// Enable mask bits, named categories take bits 1 to 62
+#define TRACE_MASK_UNCATEGORIZED (1ull << 0) // events emitted without a category
+#define TRACE_MASK_ENABLED (1ull << 63)      // global switch
+
+#endif // TRACE_EVENT_H
@@ -59,4 +59,49 @@
         MAP_STRINGIFY_4, MAP_STRINGIFY_3, MAP_STRINGIFY_2, MAP_STRINGIFY_1,     \
         MAP_STRINGIFY_OVERFLOW)(__VA_ARGS__)
 
+// MAP(f, Label1, Label2, ..., LabelN)
+//  => f(Label1), f(Label2), ..., f(LabelN)
+// Up to 16 arguments are supported.
+#define MAP_1(f, a) \
+    f(a)
+#define MAP_2(f, a, b) \
+    MAP_1(f, a), f(b)
+#define MAP_3(f, a, b, c) \
+    MAP_2(f, a, b), f(c)
+#define MAP_4(f, a, b, c, d) \
+    MAP_3(f, a, b, c), f(d)
+#define MAP_5(f, a, b, c, d, e) \
+    MAP_4(f, a, b, c, d), f(e)
+#define MAP_6(f, a, b, c, d, e, g) \
+    MAP_5(f, a, b, c, d, e), f(g)
+#define MAP_7(f, a, b, c, d, e, g, h) \
+    MAP_6(f, a, b, c, d, e, g), f(h)
+#define MAP_8(f, a, b, c, d, e, g, h, i) \
+    MAP_7(f, a, b, c, d, e, g, h), f(i)
+#define MAP_9(f, a, b, c, d, e, g, h, i, j) \
+    MAP_8(f, a, b, c, d, e, g, h, i), f(j)
+#define MAP_10(f, a, b, c, d, e, g, h, i, j, k) \
+    MAP_9(f, a, b, c, d, e, g, h, i, j), f(k)
+#define MAP_11(f, a, b, c, d, e, g, h, i, j, k, l) \
+    MAP_10(f, a, b, c, d, e, g, h, i, j, k), f(l)
+#define MAP_12(f, a, b, c, d, e, g, h, i, j, k, l, m) \
+    MAP_11(f, a, b, c, d, e, g, h, i, j, k, l), f(m)
+#define MAP_13(f, a, b, c, d, e, g, h, i, j, k, l, m, n) \
+    MAP_12(f, a, b, c, d, e, g, h, i, j, k, l, m), f(n)
+#define MAP_14(f, a, b, c, d, e, g, h, i, j, k, l, m, n, o) \
+    MAP_13(f, a, b, c, d, e, g, h, i, j, k, l, m, n), f(o)
+#define MAP_15(f, a, b, c, d, e, g, h, i, j, k, l, m, n, o, p) \
+    MAP_14(f, a, b, c, d, e, g, h, i, j, k, l, m, n, o), f(p)
+#define MAP_16(f, a, b, c, d, e, g, h, i, j, k, l, m, n, o, p, q) \
+    MAP_15(f, a, b, c, d, e, g, h, i, j, k, l, m, n, o, p), f(q)
+#define MAP_OVERFLOW(...) \
+    static_assert(0, "Too many arguments to MAP — max is 16.")
+
+#define MAP(f, ...)                                             \
+    GET_MAP_STRINGIFY_MACRO(                                    \
+        __VA_ARGS__,                                            \
+        MAP_16, MAP_15, MAP_14, MAP_13, MAP_12, MAP_11, MAP_10, \
+        MAP_9, MAP_8, MAP_7, MAP_6, MAP_5, MAP_4, MAP_3, MAP_2, \
+        MAP_1, MAP_OVERFLOW)(f, __VA_ARGS__)
+
 #endif // TRACER_MACRO_UTILS_H
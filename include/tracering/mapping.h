@@ -0,0 +1,20 @@
+#ifndef TRACER_MAPPING_H
+#define TRACER_MAPPING_H
+
+// How the shared segment is mapped. The receiver's flags decide where the segment
+// lives (hugetlbfs or tmpfs), each emitter's flags apply to its own mapping of it.
+// Every option is best effort: tracer_receiver_mapping() and tracer_emit_mapping()
+// report what was actually obtained.
+typedef enum
+{
+    TRACE_MAP_DEFAULT = 0,        // pages are faulted in lazily on first write
+    TRACE_MAP_HUGEPAGES = 1 << 0, // hugetlbfs if mounted with enough free pages, else transparent huge pages
+    TRACE_MAP_POPULATE = 1 << 1,  // prefault the whole segment at init
+    TRACE_MAP_LOCK = 1 << 2,      // mlock the segment, subject to RLIMIT_MEMLOCK
+
+    // Only reported, in place of TRACE_MAP_HUGEPAGES
+    TRACE_MAP_HUGETLB = 1 << 3, // the segment lives in hugetlbfs
+    TRACE_MAP_THP = 1 << 4,     // transparent huge pages advised and enabled for this kind of memory
+} trace_map_flags_t;
+
+#endif // TRACER_MAPPING_H
@@ -1,7 +1,12 @@
 #ifndef TRACER_RECEIVE_H
 #define TRACER_RECEIVE_H
 
+#include <stddef.h>
+
+#include "tracering/backpressure.h"
+#include "tracering/clock.h"
 #include "tracering/event.h"
+#include "tracering/mapping.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -10,13 +15,139 @@ extern "C"
 
     typedef void (*trace_event_handler_t)(const trace_event_t *event);
 
-    void tracer_receiver_init(void);
+    // How tracer_receiver_wait() waits for events once the rings are empty
+    typedef enum
+    {
+        TRACE_WAIT_SPIN = 0,   // poll continuously, lowest latency, burns a core
+        TRACE_WAIT_SPIN_YIELD, // poll for wait_spin_ns, then poll with sched_yield() in between
+        TRACE_WAIT_ADAPTIVE,   // poll for wait_spin_ns, then sleep on a futex until an emitter publishes
+    } trace_wait_strategy_t;
+
+#define TRACER_WAIT_FOREVER UINT64_MAX
+
+    typedef struct
+    {
+        trace_clock_source_t clock;        // clock emitters use to timestamp events
+        uint64_t stall_timeout_ns;         // skip a shared ring record claimed by a producer that never
+                                           // finished writing it after this long, 0 waits forever
+        uint32_t ring_capacity;            // 8-byte units per ring, rounded up to a power of two. An event
+                                           // takes 2 units on its thread's ring, up to 9 with arguments
+        uint32_t ring_count;               // shared ring + per-thread rings, threads beyond this share ring 0
+        unsigned int map_flags;            // TRACE_MAP_* options for the segment
+        trace_backpressure_t backpressure; // what emitters do when their ring is full
+        uint64_t spin_ns;                  // TRACE_BACKPRESSURE_SPIN: longest wait before dropping
+        trace_wait_strategy_t wait_strategy;
+        uint64_t wait_spin_ns;             // polling time before yielding or sleeping
+        int cpu;                           // pin the thread calling tracer_receiver_wait() to this CPU, -1 = don't
+        const char *session;               // session to create, NULL: $TRACERING_SESSION or the default session
+        uint32_t payload_max;              // bytes per TRACE_DATA payload, at most TRACE_PAYLOAD_MAX and half
+                                           // a ring, longer payloads are truncated
+    } tracer_receiver_config_t;
+
+#define TRACER_RECEIVER_CONFIG_DEFAULT                                                              \
+    {TRACE_CLOCK_MONOTONIC, 100000000, 32768, 64, TRACE_MAP_DEFAULT, TRACE_BACKPRESSURE_DROP, 10000, \
+     TRACE_WAIT_ADAPTIVE, 50000, -1, NULL, 1024}
+
+    // Emitter-side event counters. Emitters copy theirs to the segment every 1024
+    // events, whenever an event is dropped and when the thread exits.
+    typedef struct
+    {
+        uint64_t emitted;      // events written to a ring
+        uint64_t dropped;      // events discarded because the ring was full
+        uint64_t overwritten;  // unread events overwritten (overwrite mode), included in emitted
+        uint64_t filtered;     // events left out by the emitter's minimum duration filter
+        uint64_t index_writes; // stores to ring indices, on cache lines the receiver also reads
+    } trace_thread_stats_t;
+
+    typedef struct
+    {
+        uint32_t tid;
+        uint32_t pid;
+        uint64_t start_timestamp; // first event of the thread, ns
+        const char *name;         // pthread name at registration, may be empty
+        const char *process_name;
+        trace_thread_stats_t stats;
+    } trace_thread_t;
+
+    void tracer_receiver_init(void); // init with TRACER_RECEIVER_CONFIG_DEFAULT
+    void tracer_receiver_init_config(const tracer_receiver_config_t *config);
     void tracer_receiver_shutdown(void);
-    void tracer_receiver_poll(void);
+    void tracer_receiver_poll(void); // delivers what is in the rings now, doesn't wait
+
+    // Sessions keep unrelated programs apart, each has its own segment and rings. A
+    // receiver can watch several: the session of tracer_receiver_init_config() is session
+    // 0, this creates the next one with the same configuration. Events of every session
+    // come as one stream ordered by timestamp, event->session tells them apart. Returns
+    // the session index, -1 if the name is invalid, already used or TRACE_SESSION_MAX is reached.
+    int tracer_receiver_add_session(const char *session);
+    // Adds a flight recorder dump written by tracer_flight_dump() as a session named after
+    // the file. Its events (the last ring capacity's worth per ring) are delivered by the
+    // next wait or poll, merged by timestamp with the live sessions. Returns the session
+    // index, -1 if the file can't be read or isn't a dump of this version.
+    int tracer_receiver_add_dump(const char *path);
+    uint32_t tracer_receiver_session_count(void);
+    const char *tracer_receiver_session_name(uint32_t session); // "" for the default session, NULL if unknown
+
+    // Waits up to `timeout_ns` (or TRACER_WAIT_FOREVER) for events and delivers them with the
+    // configured wait strategy. Returns the number of events delivered, 0 on timeout or stop.
+    unsigned int tracer_receiver_wait(uint64_t timeout_ns);
+    void tracer_receiver_run(void);  // delivers events until tracer_receiver_stop()
+    void tracer_receiver_stop(void); // makes run() and wait() return, async-signal-safe
+
+    // clock actually in use, TRACE_CLOCK_TSC falls back to TRACE_CLOCK_MONOTONIC
+    // if the TSC is not invariant or could not be calibrated
+    trace_clock_source_t tracer_receiver_clock(void);
+
+    // TRACE_MAP_* options obtained for the segment, see tracering/mapping.h
+    unsigned int tracer_receiver_mapping(void);
+
+    // Changes the full-ring policy, emitting threads pick it up within 1024 events
+    void tracer_receiver_set_backpressure(trace_backpressure_t backpressure);
+
+    // Runtime filtering, takes effect at the next TRACE* macro. Everything is enabled at init.
+    void tracer_receiver_set_enabled(int enabled); // global switch, categories keep their state
+    void tracer_receiver_enable_category(const char *category, int enabled); // NULL: uncategorized events
+    void tracer_receiver_enable_all_categories(int enabled);
 
     void tracer_receiver_register_handler(trace_event_handler_t handler);
     void tracer_receiver_unregister_handler(trace_event_handler_t handler);
 
+    // Resolve an event's callsite, strings point into the shared segment and stay valid
+    // until tracer_receiver_shutdown(). Returns 0 on success, -1 if unknown.
+    int tracer_receiver_event_callsite(const trace_event_t *event, trace_callsite_t *callsite);
+    const char *tracer_receiver_event_label(const trace_event_t *event); // "?" if unknown
+
+    // Same by id, for session 0
+    int tracer_receiver_callsite(uint32_t callsite_id, trace_callsite_t *callsite);
+    const char *tracer_receiver_label(uint32_t callsite_id);
+
+    // Formats a TRACE_ARGS event's arguments with its callsite's format, like snprintf:
+    // returns the length of the full text, or -1 if the event has no format. Typed values
+    // are in event->args, their types in the callsite's arg_types.
+    int tracer_receiver_format(const trace_event_t *event, char *buf, size_t size);
+
+    // Function name of an event emitted by libtracering-autoinst, read from the symbol
+    // table of the executable or library (cached per file), "module+0x..." if it has
+    // none. NULL for other events. Valid until tracer_receiver_shutdown().
+    const char *tracer_receiver_symbol(const trace_event_t *event);
+
+    // Payload of a TRACE_DATA / TRACE_STRING event, only valid during the handler call the
+    // event was passed to. NULL (size 0) for other events, or if a producer lapped the
+    // receiver and overwrote the payload before it was read (TRACE_BACKPRESSURE_OVERWRITE).
+    const void *tracer_receiver_payload(const trace_event_t *event, uint32_t *size);
+
+    // Resolve an event's thread. The registry entry is reused once the thread has exited
+    // and all of its events have been delivered, so the strings are only valid until the
+    // end of the tracer_receiver_poll() call that delivered the event; copy them if they
+    // are needed later. Returns 0 on success, -1 if unknown.
+    int tracer_receiver_event_thread(const trace_event_t *event, trace_thread_t *thread);
+    int tracer_receiver_session_thread(uint32_t session, uint32_t thread_index, trace_thread_t *thread);
+    int tracer_receiver_thread(uint32_t thread_index, trace_thread_t *thread); // session 0
+
+    // Sum of the counters of every thread seen since tracer_receiver_init(), including
+    // threads that have exited, over all sessions
+    void tracer_receiver_stats(trace_thread_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,9 @@
 #include "tracering/receiver_ex.h"
 #include "tracering/internal/handler_overload.hpp"
 
+#include <string>
+#include <string_view>
+
 namespace tracering::receiver
 {
     struct ReceiverBinding
@@ -26,8 +29,46 @@ namespace tracering::receiver
     };
 
     inline void init() { tracer_receiver_init(); }
+    inline void init(const tracer_receiver_config_t &config) { tracer_receiver_init_config(&config); }
     inline void shutdown() { tracer_receiver_shutdown(); }
     inline void poll() { tracer_receiver_poll(); }
+    inline int add_session(const char *session) { return tracer_receiver_add_session(session); }
+    inline int add_dump(const char *path) { return tracer_receiver_add_dump(path); }
+    inline uint32_t session_count() { return tracer_receiver_session_count(); }
+    inline const char *session_name(uint32_t session) { return tracer_receiver_session_name(session); }
+    inline unsigned int wait(uint64_t timeout_ns = TRACER_WAIT_FOREVER) { return tracer_receiver_wait(timeout_ns); }
+    inline void run() { tracer_receiver_run(); }
+    inline void stop() { tracer_receiver_stop(); }
+    inline void set_backpressure(trace_backpressure_t backpressure) { tracer_receiver_set_backpressure(backpressure); }
+    inline const char *label(uint32_t callsite_id) { return tracer_receiver_label(callsite_id); }
+    inline const char *label(const trace_event_t &event) { return tracer_receiver_event_label(&event); }
+    inline bool callsite(uint32_t callsite_id, trace_callsite_t &callsite) { return tracer_receiver_callsite(callsite_id, &callsite) == 0; }
+    inline bool callsite(const trace_event_t &event, trace_callsite_t &callsite) { return tracer_receiver_event_callsite(&event, &callsite) == 0; }
+    inline std::string format(const trace_event_t &event)
+    {
+        int len = tracer_receiver_format(&event, nullptr, 0);
+        if (len <= 0)
+            return std::string();
+        std::string text((size_t)len, '\0');
+        tracer_receiver_format(&event, text.data(), text.size() + 1);
+        return text;
+    }
+    inline const char *symbol(const trace_event_t &event) { return tracer_receiver_symbol(&event); }
+    inline std::string_view payload(const trace_event_t &event)
+    {
+        uint32_t size;
+        const void *data = tracer_receiver_payload(&event, &size);
+        return std::string_view(static_cast<const char *>(data), size);
+    }
+    inline bool thread(uint32_t thread_index, trace_thread_t &thread) { return tracer_receiver_thread(thread_index, &thread) == 0; }
+    inline bool thread(uint32_t session, uint32_t thread_index, trace_thread_t &thread) { return tracer_receiver_session_thread(session, thread_index, &thread) == 0; }
+    inline bool thread(const trace_event_t &event, trace_thread_t &thread) { return tracer_receiver_event_thread(&event, &thread) == 0; }
+    inline trace_thread_stats_t stats()
+    {
+        trace_thread_stats_t stats;
+        tracer_receiver_stats(&stats);
+        return stats;
+    }
 
     template <typename Handler>
     inline void register_handler(Handler &&cb) { ReceiverBinding::register_handler(std::forward<Handler>(cb)); }
@@ -0,0 +1,271 @@
+#include "tracering/adapter/counter.h"
+#include "tracering/adapter/counter_ex.h"
+#include "tracering/receiver.h"
+#include "../internal/buffer.h"
+#include "../internal/dispatcher.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COUNTER_MAX 256
+#define COUNTER_NAME_MAX 64
+
+typedef struct
+{
+    char name[COUNTER_NAME_MAX];
+    uint32_t kind;
+    double value;       // running total for counters
+    uint64_t timestamp; // of the event that set the value
+    uint64_t samples;
+
+    // Ring of the most recent non-empty buckets, newest at `head`
+    trace_counter_bucket_t *buckets;
+    uint32_t head;
+    uint32_t used;
+} counter_t;
+
+static counter_t counters[COUNTER_MAX];
+static uint32_t counter_count = 0;
+
+// Callsites with the same name and kind feed the same counter (across sessions too),
+// resolved once per callsite: 0 = not looked up yet, otherwise counter id + 1
+static uint16_t callsite_counters[TRACE_SESSION_MAX][TRACE_CALLSITE_MAX];
+
+static tracer_counter_config_t counter_config = TRACER_COUNTER_CONFIG_DEFAULT;
+static pthread_mutex_t adapter_mutex = PTHREAD_MUTEX_INITIALIZER;
+static dispatcher_t *sample_dispatcher = NULL;
+
+static double arg_to_double(char type, trace_arg_t arg)
+{
+    switch (type)
+    {
+    case TRACE_ARG_INT:
+        return (double)arg.i;
+    case TRACE_ARG_DOUBLE:
+        return arg.f;
+    default:
+        return (double)arg.u;
+    }
+}
+
+// Returns the counter fed by the callsite, or NULL if it is not a value callsite
+// (or there are too many counters). Called with adapter_mutex held.
+static counter_t *resolve_counter(const trace_event_t *event, const trace_callsite_t *callsite)
+{
+    uint16_t *cached = &callsite_counters[event->session][event->callsite_id];
+    if (*cached)
+        return &counters[*cached - 1];
+
+    for (uint32_t i = 0; i < counter_count; ++i)
+    {
+        if (counters[i].kind == callsite->value_kind && strncmp(counters[i].name, callsite->label, COUNTER_NAME_MAX - 1) == 0)
+        {
+            *cached = (uint16_t)(i + 1);
+            return &counters[i];
+        }
+    }
+
+    if (counter_count == COUNTER_MAX)
+        return NULL;
+
+    trace_counter_bucket_t *buckets = calloc(counter_config.bucket_count, sizeof(trace_counter_bucket_t));
+    if (!buckets)
+        return NULL;
+
+    counter_t *counter = &counters[counter_count];
+    memset(counter, 0, sizeof(*counter));
+    strncpy(counter->name, callsite->label, COUNTER_NAME_MAX - 1);
+    counter->kind = callsite->value_kind;
+    counter->buckets = buckets;
+    *cached = (uint16_t)++counter_count;
+    return counter;
+}
+
+static void add_to_series(counter_t *counter, uint64_t timestamp, double value)
+{
+    uint64_t start = timestamp - timestamp % counter_config.bucket_ns;
+
+    // Events from different threads arrive slightly out of order, walk back to the
+    // bucket they belong to. Samples older than the history only count in the totals.
+    uint32_t i = counter->head;
+    for (uint32_t n = 0; n < counter->used; ++n)
+    {
+        trace_counter_bucket_t *bucket = &counter->buckets[i];
+        if (bucket->start_timestamp == start)
+        {
+            if (value < bucket->min)
+                bucket->min = value;
+            if (value > bucket->max)
+                bucket->max = value;
+            bucket->last = value;
+            bucket->samples++;
+            return;
+        }
+        if (bucket->start_timestamp < start)
+            break;
+        i = i ? i - 1 : counter_config.bucket_count - 1;
+    }
+    if (counter->used && counter->buckets[counter->head].start_timestamp > start)
+        return; // an empty bucket before the newest one, don't insert in the middle
+
+    counter->head = counter->used ? (counter->head + 1) % counter_config.bucket_count : 0;
+    if (counter->used < counter_config.bucket_count)
+        counter->used++;
+    counter->buckets[counter->head] = (trace_counter_bucket_t){start, value, value, value, 1};
+}
+
+void counter_event_handler(const trace_event_t *event)
+{
+    if (!event || event->arg_count == 0 || event->callsite_id == TRACE_CALLSITE_NONE ||
+        event->callsite_id >= TRACE_CALLSITE_MAX || event->session >= TRACE_SESSION_MAX)
+        return;
+
+    trace_callsite_t callsite;
+    if (tracer_receiver_event_callsite(event, &callsite) != 0 ||
+        (callsite.value_kind != TRACE_VALUE_COUNTER && callsite.value_kind != TRACE_VALUE_GAUGE))
+        return;
+
+    pthread_mutex_lock(&adapter_mutex);
+    counter_t *counter = resolve_counter(event, &callsite);
+    if (!counter)
+    {
+        pthread_mutex_unlock(&adapter_mutex);
+        return;
+    }
+
+    // A sampled event stands for `weight` of them. Rings are drained one after the
+    // other, so a gauge only moves forward in time: a late value still goes to its
+    // bucket but doesn't replace a newer one.
+    double value = arg_to_double(callsite.arg_types[0], event->args[0]);
+    double previous = counter->value;
+    if (counter->kind == TRACE_VALUE_COUNTER)
+        counter->value += value * (event->weight ? event->weight : 1);
+    else if (event->timestamp >= counter->timestamp)
+        counter->value = value;
+    if (event->timestamp > counter->timestamp)
+        counter->timestamp = event->timestamp;
+    counter->samples++;
+    add_to_series(counter, event->timestamp, counter->kind == TRACE_VALUE_COUNTER ? counter->value : value);
+
+    trace_counter_sample_t sample = {
+        .name = counter->name,
+        .timestamp = event->timestamp,
+        .value = counter->value,
+        .delta = counter->value - previous,
+        .counter_id = (uint32_t)(counter - counters),
+        .kind = counter->kind,
+        .thread_index = event->thread_index,
+        .session = event->session};
+    pthread_mutex_unlock(&adapter_mutex);
+
+    dispatcher_emit(sample_dispatcher, &sample);
+}
+
+int tracer_adapter_counter_init(void)
+{
+    return tracer_adapter_counter_init_config(NULL);
+}
+
+int tracer_adapter_counter_init_config(const tracer_counter_config_t *config)
+{
+    tracer_counter_config_t defaults = TRACER_COUNTER_CONFIG_DEFAULT;
+    if (!config)
+        config = &defaults;
+    if (config->bucket_ns == 0 || config->bucket_count == 0)
+        return -1;
+
+    pthread_mutex_lock(&adapter_mutex);
+    counter_config = *config;
+    counter_count = 0;
+    memset(callsite_counters, 0, sizeof(callsite_counters));
+    pthread_mutex_unlock(&adapter_mutex);
+
+    sample_dispatcher = dispatcher_create(/*max_handlers=*/16, /*num_threads=*/0);
+    tracer_receiver_register_handler(counter_event_handler);
+    return 0;
+}
+
+void tracer_adapter_counter_shutdown(void)
+{
+    tracer_receiver_unregister_handler(counter_event_handler);
+
+    pthread_mutex_lock(&adapter_mutex);
+    for (uint32_t i = 0; i < counter_count; ++i)
+        free(counters[i].buckets);
+    counter_count = 0;
+    memset(callsite_counters, 0, sizeof(callsite_counters));
+    pthread_mutex_unlock(&adapter_mutex);
+
+    dispatcher_destroy(sample_dispatcher);
+    sample_dispatcher = NULL;
+}
+
+uint32_t tracer_adapter_counter_count(void)
+{
+    pthread_mutex_lock(&adapter_mutex);
+    uint32_t count = counter_count;
+    pthread_mutex_unlock(&adapter_mutex);
+    return count;
+}
+
+int tracer_adapter_counter_info(uint32_t counter_id, trace_counter_info_t *info)
+{
+    pthread_mutex_lock(&adapter_mutex);
+    if (counter_id >= counter_count)
+    {
+        pthread_mutex_unlock(&adapter_mutex);
+        return -1;
+    }
+
+    const counter_t *counter = &counters[counter_id];
+    info->name = counter->name;
+    info->kind = counter->kind;
+    info->value = counter->value;
+    info->samples = counter->samples;
+    pthread_mutex_unlock(&adapter_mutex);
+    return 0;
+}
+
+uint32_t tracer_adapter_counter_series(uint32_t counter_id, trace_counter_bucket_t *buckets, uint32_t max)
+{
+    pthread_mutex_lock(&adapter_mutex);
+    if (counter_id >= counter_count)
+    {
+        pthread_mutex_unlock(&adapter_mutex);
+        return 0;
+    }
+
+    const counter_t *counter = &counters[counter_id];
+    uint32_t count = counter->used < max ? counter->used : max;
+    uint32_t first = (counter->head + counter_config.bucket_count - (count - 1)) % counter_config.bucket_count;
+    for (uint32_t i = 0; i < count; ++i)
+        buckets[i] = counter->buckets[(first + i) % counter_config.bucket_count];
+    pthread_mutex_unlock(&adapter_mutex);
+    return count;
+}
+
+void tracer_adapter_counter_register_handler_ex(trace_counter_handler_ex_t fn, void *ctx)
+{
+    dispatcher_register(sample_dispatcher, (dispatcher_callback_t)fn, ctx);
+}
+
+void tracer_adapter_counter_unregister_handler_ex(trace_counter_handler_ex_t fn, void *ctx)
+{
+    dispatcher_unregister(sample_dispatcher, (dispatcher_callback_t)fn, ctx);
+}
+
+static void adapter(const void *sample, void *ctx)
+{
+    ((trace_counter_handler_t)ctx)((const trace_counter_sample_t *)sample);
+}
+
+void tracer_adapter_counter_register_handler(trace_counter_handler_t fn)
+{
+    dispatcher_register(sample_dispatcher, adapter, (void *)fn);
+}
+
+void tracer_adapter_counter_unregister_handler(trace_counter_handler_t fn)
+{
+    dispatcher_unregister(sample_dispatcher, adapter, (void *)fn);
+}
@@ -0,0 +1,310 @@
+#include "tracering/adapter/flow.h"
+#include "tracering/adapter/flow_ex.h"
+#include "tracering/receiver.h"
+#include "../internal/dispatcher.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#define FLOW_MAX 4096 // flows in flight, power of two
+#define FLOW_REPORT_BATCH 32
+
+// Ages in event time: a finished flow is reported once it has waited this long for steps
+// still in other rings, a step or end without a begin is dropped after this long
+#define FLOW_SETTLE_NS 10000000ull
+#define FLOW_EXPIRE_NS 10000000000ull
+
+typedef struct
+{
+    int used;
+    int have_begin;
+    int have_end;
+    uint16_t session;
+    uint64_t last_timestamp; // latest event of the flow
+    trace_flow_t flow;
+} flow_slot_t;
+
+// Open addressing on the session and correlation id, linear probing
+static flow_slot_t flows[FLOW_MAX];
+static uint32_t flow_count = 0;
+static uint64_t flows_lost = 0;
+
+// Latest event timestamp seen, and when the table is next swept
+static _Atomic uint64_t flow_now = 0;
+static _Atomic uint64_t flow_next_sweep = 0;
+
+static pthread_mutex_t adapter_mutex = PTHREAD_MUTEX_INITIALIZER;
+static dispatcher_t *flow_dispatcher = NULL;
+
+static uint32_t flow_hash(uint16_t session, uint64_t id)
+{
+    id ^= (uint64_t)session * 0x9e3779b97f4a7c15ull;
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdull;
+    id ^= id >> 33;
+    return (uint32_t)id & (FLOW_MAX - 1);
+}
+
+static flow_slot_t *find_flow(uint16_t session, uint64_t id)
+{
+    for (uint32_t i = flow_hash(session, id), n = 0; n < FLOW_MAX && flows[i].used;
+         i = (i + 1) & (FLOW_MAX - 1), ++n)
+    {
+        if (flows[i].flow.id == id && flows[i].session == session)
+            return &flows[i];
+    }
+    return NULL;
+}
+
+static flow_slot_t *insert_flow(uint16_t session, uint64_t id)
+{
+    if (flow_count == FLOW_MAX)
+        return NULL;
+
+    uint32_t i = flow_hash(session, id);
+    while (flows[i].used)
+        i = (i + 1) & (FLOW_MAX - 1);
+    memset(&flows[i], 0, sizeof(flows[i]));
+    flows[i].used = 1;
+    flows[i].session = session;
+    flows[i].flow.id = id;
+    flow_count++;
+    return &flows[i];
+}
+
+// Backward shift deletion, keeps probe sequences intact without tombstones
+static void remove_flow(flow_slot_t *slot)
+{
+    uint32_t hole = (uint32_t)(slot - flows);
+    for (uint32_t i = (hole + 1) & (FLOW_MAX - 1); flows[i].used; i = (i + 1) & (FLOW_MAX - 1))
+    {
+        uint32_t home = flow_hash(flows[i].session, flows[i].flow.id);
+        // Move the entry into the hole unless its home lies cyclically in (hole, i]
+        if (((i - home) & (FLOW_MAX - 1)) >= ((i - hole) & (FLOW_MAX - 1)))
+        {
+            flows[hole] = flows[i];
+            hole = i;
+        }
+    }
+    flows[hole].used = 0;
+    flow_count--;
+}
+
+// Copies a flow that has both its begin and end out of the table and removes it
+static void finish_flow(flow_slot_t *slot, trace_flow_t *done)
+{
+    *done = slot->flow;
+    remove_flow(slot);
+
+    if (done->steps == 0)
+    {
+        done->start_label = done->end_label;
+        done->start_timestamp = done->end_timestamp;
+        done->start_thread_id = done->end_thread_id;
+        done->start_pid = done->end_pid;
+    }
+    // Timestamps of different threads can be slightly out of order
+    done->queue_ns = done->start_timestamp > done->begin_timestamp ? done->start_timestamp - done->begin_timestamp : 0;
+    done->run_ns = done->end_timestamp > done->start_timestamp ? done->end_timestamp - done->start_timestamp : 0;
+}
+
+// Reports the finished flows that have waited FLOW_SETTLE_NS before `now` (all of them
+// with UINT64_MAX) and drops the steps and ends whose begin never came
+static void sweep_flows(uint64_t now)
+{
+    trace_flow_t done[FLOW_REPORT_BATCH];
+    uint32_t count;
+    do
+    {
+        count = 0;
+        pthread_mutex_lock(&adapter_mutex);
+        for (uint32_t i = 0; i < FLOW_MAX && count < FLOW_REPORT_BATCH;)
+        {
+            flow_slot_t *slot = &flows[i];
+            uint64_t age = now > slot->last_timestamp ? now - slot->last_timestamp : 0;
+            if (slot->used && slot->have_begin && slot->have_end && age >= FLOW_SETTLE_NS)
+                finish_flow(slot, &done[count++]); // the next entry may have moved into i
+            else if (slot->used && !slot->have_begin && age >= FLOW_EXPIRE_NS && now != UINT64_MAX)
+            {
+                flows_lost++;
+                remove_flow(slot);
+            }
+            else
+                i++;
+        }
+        pthread_mutex_unlock(&adapter_mutex);
+
+        for (uint32_t i = 0; i < count; ++i)
+            dispatcher_emit(flow_dispatcher, &done[i]);
+    } while (count == FLOW_REPORT_BATCH);
+}
+
+// Rings are drained one after the other, so the events of a flow emitted on different
+// threads arrive in any order: a flow is reported once both its begin and its end have
+// been seen and no event of it came for FLOW_SETTLE_NS, the earliest step seen by then
+// marks where it started running.
+void flow_event_handler(const trace_event_t *event)
+{
+    if (!event)
+        return;
+
+    // Every event moves the adapter's clock, sweeps run every half settle time
+    uint64_t now = atomic_load_explicit(&flow_now, memory_order_relaxed);
+    if (event->timestamp > now)
+        atomic_store_explicit(&flow_now, now = event->timestamp, memory_order_relaxed);
+    if (now >= atomic_load_explicit(&flow_next_sweep, memory_order_relaxed))
+    {
+        atomic_store_explicit(&flow_next_sweep, now + FLOW_SETTLE_NS / 2, memory_order_relaxed);
+        sweep_flows(now);
+    }
+
+    trace_callsite_t callsite;
+    if (event->arg_count == 0 || tracer_receiver_event_callsite(event, &callsite) != 0 ||
+        callsite.value_kind < TRACE_VALUE_FLOW_BEGIN || callsite.value_kind > TRACE_VALUE_FLOW_END)
+        return;
+
+    trace_thread_t thread = {0};
+    tracer_receiver_event_thread(event, &thread);
+
+    uint64_t id = event->args[0].u;
+    trace_flow_t done;
+    int ended = 0;
+
+    pthread_mutex_lock(&adapter_mutex);
+    flow_slot_t *slot = find_flow(event->session, id);
+    if (slot && slot->have_begin && slot->have_end && callsite.value_kind == TRACE_VALUE_FLOW_BEGIN)
+    {
+        // The id was reused once the previous flow ended, report that one now
+        finish_flow(slot, &done);
+        ended = 1;
+        slot = NULL;
+    }
+    if (!slot && !(slot = insert_flow(event->session, id)))
+    {
+        flows_lost++;
+        pthread_mutex_unlock(&adapter_mutex);
+        if (ended)
+            dispatcher_emit(flow_dispatcher, &done);
+        return;
+    }
+    trace_flow_t *flow = &slot->flow;
+    if (event->timestamp > slot->last_timestamp)
+        slot->last_timestamp = event->timestamp;
+
+    switch (callsite.value_kind)
+    {
+    case TRACE_VALUE_FLOW_BEGIN:
+        if (slot->have_begin)
+        {
+            // The id was reused before the previous flow ended, start over
+            flows_lost++;
+            memset(flow, 0, sizeof(*flow));
+            flow->id = id;
+            slot->have_end = 0;
+        }
+        slot->have_begin = 1;
+        flow->begin_label = callsite.label;
+        flow->begin_timestamp = event->timestamp;
+        flow->begin_thread_id = thread.tid;
+        flow->begin_pid = thread.pid;
+        break;
+
+    case TRACE_VALUE_FLOW_STEP:
+        if (flow->steps++ == 0 || event->timestamp < flow->start_timestamp)
+        {
+            flow->start_label = callsite.label;
+            flow->start_timestamp = event->timestamp;
+            flow->start_thread_id = thread.tid;
+            flow->start_pid = thread.pid;
+        }
+        break;
+
+    case TRACE_VALUE_FLOW_END:
+        slot->have_end = 1;
+        flow->end_label = callsite.label;
+        flow->end_timestamp = event->timestamp;
+        flow->end_thread_id = thread.tid;
+        flow->end_pid = thread.pid;
+        break;
+    }
+    pthread_mutex_unlock(&adapter_mutex);
+
+    if (ended)
+        dispatcher_emit(flow_dispatcher, &done);
+}
+
+int tracer_adapter_flow_init(void)
+{
+    flow_dispatcher = dispatcher_create(/*max_handlers=*/16, /*num_threads=*/0);
+    tracer_receiver_register_handler(flow_event_handler);
+
+    pthread_mutex_lock(&adapter_mutex);
+    memset(flows, 0, sizeof(flows));
+    flow_count = 0;
+    flows_lost = 0;
+    atomic_store(&flow_now, 0);
+    atomic_store(&flow_next_sweep, 0);
+    pthread_mutex_unlock(&adapter_mutex);
+
+    return 0;
+}
+
+void tracer_adapter_flow_shutdown(void)
+{
+    tracer_receiver_unregister_handler(flow_event_handler);
+
+    pthread_mutex_lock(&adapter_mutex);
+    memset(flows, 0, sizeof(flows));
+    flow_count = 0;
+    pthread_mutex_unlock(&adapter_mutex);
+
+    dispatcher_destroy(flow_dispatcher);
+    flow_dispatcher = NULL;
+}
+
+void tracer_adapter_flow_flush(void)
+{
+    sweep_flows(UINT64_MAX);
+}
+
+uint32_t tracer_adapter_flow_pending(void)
+{
+    pthread_mutex_lock(&adapter_mutex);
+    uint32_t count = flow_count;
+    pthread_mutex_unlock(&adapter_mutex);
+    return count;
+}
+
+uint64_t tracer_adapter_flow_lost(void)
+{
+    pthread_mutex_lock(&adapter_mutex);
+    uint64_t lost = flows_lost;
+    pthread_mutex_unlock(&adapter_mutex);
+    return lost;
+}
+
+void tracer_adapter_flow_register_handler_ex(trace_flow_handler_ex_t fn, void *ctx)
+{
+    dispatcher_register(flow_dispatcher, (dispatcher_callback_t)fn, ctx);
+}
+
+void tracer_adapter_flow_unregister_handler_ex(trace_flow_handler_ex_t fn, void *ctx)
+{
+    dispatcher_unregister(flow_dispatcher, (dispatcher_callback_t)fn, ctx);
+}
+
+static void adapter(const void *flow, void *ctx)
+{
+    ((trace_flow_handler_t)ctx)((const trace_flow_t *)flow);
+}
+
+void tracer_adapter_flow_register_handler(trace_flow_handler_t fn)
+{
+    dispatcher_register(flow_dispatcher, adapter, (void *)fn);
+}
+
+void tracer_adapter_flow_unregister_handler(trace_flow_handler_t fn)
+{
+    dispatcher_unregister(flow_dispatcher, adapter, (void *)fn);
+}
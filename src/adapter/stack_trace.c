@@ -1,6 +1,7 @@
 #include "tracering/adapter/stack_trace.h"
 #include "tracering/adapter/stack_trace_ex.h"
 #include "tracering/receiver.h"
+#include "../internal/buffer.h"
 #include "../internal/dispatcher.h"
 
 #include <pthread.h>
@@ -8,45 +9,45 @@
 #include <stdio.h>
 
 #define MAX_STACK_DEPTH 32
-#define MAX_THREADS 64
 
 typedef struct
 {
-    char label[TRACE_EVENT_PAYLOAD_MAX];
-    char full_path[256];
+    uint32_t callsite_id;
+    uint64_t address; // function of an autoinst event, its callsite is the function's module
+    const char *label;
     uint64_t start_timestamp;
+    uint32_t weight;
 } stack_entry_t;
 
+// Open scopes of a thread indexed by depth, TRACE_CALLSITE_NONE where no scope is open
+// (or its begin event was lost)
 typedef struct
 {
-    uint32_t thread_id;
+    uint32_t tid; // registry entries are reused, tid/pid tell threads apart
+    uint32_t pid;
     stack_entry_t stack[MAX_STACK_DEPTH];
-    int stack_top;
-    int active;
 } thread_stack_t;
 
-static thread_stack_t thread_stacks[MAX_THREADS];
+// Indexed by session and thread registry index
+static thread_stack_t thread_stacks[TRACE_SESSION_MAX][TRACE_THREAD_MAX];
 static pthread_mutex_t adapter_mutex = PTHREAD_MUTEX_INITIALIZER;
 static dispatcher_t *span_dispatcher = NULL;
 
-static thread_stack_t *get_thread_stack(uint32_t thread_id)
+static thread_stack_t *get_thread_stack(const trace_event_t *event)
 {
-    for (int i = 0; i < MAX_THREADS; ++i)
-    {
-        if (thread_stacks[i].active && thread_stacks[i].thread_id == thread_id)
-            return &thread_stacks[i];
-    }
-    for (int i = 0; i < MAX_THREADS; ++i)
+    trace_thread_t thread;
+    if (event->session >= TRACE_SESSION_MAX || tracer_receiver_event_thread(event, &thread) != 0)
+        return NULL;
+
+    thread_stack_t *ts = &thread_stacks[event->session][event->thread_index];
+    if (ts->tid != thread.tid || ts->pid != thread.pid)
     {
-        if (!thread_stacks[i].active)
-        {
-            thread_stacks[i].thread_id = thread_id;
-            thread_stacks[i].stack_top = -1;
-            thread_stacks[i].active = 1;
-            return &thread_stacks[i];
-        }
+        // First event of the thread using this registry entry
+        ts->tid = thread.tid;
+        ts->pid = thread.pid;
+        memset(ts->stack, 0, sizeof(ts->stack));
     }
-    return NULL;
+    return ts;
 }
 
 static void notify_handlers(const trace_span_t *span)
@@ -54,60 +55,124 @@ static void notify_handlers(const trace_span_t *span)
     dispatcher_emit(span_dispatcher, span);
 }
 
-void stack_trace_event_handler(const trace_event_t *event)
+// Scope label, or function name for events of instrumented functions
+static const char *event_label(const trace_event_t *event)
+{
+    const char *symbol = tracer_receiver_symbol(event);
+    return symbol ? symbol : tracer_receiver_event_label(event);
+}
+
+// Joins the labels of the scopes open below `depth` and the leaf's into "Trace1;Trace2;Trace3"
+static void build_full_path(const thread_stack_t *ts, uint32_t depth, const char *leaf_label, char *path, size_t size)
+{
+    size_t len = 0;
+    path[0] = '\0';
+    for (uint32_t i = 0; i <= depth && len < size - 1; ++i)
+    {
+        const char *label = i < depth ? ts->stack[i].label : leaf_label;
+        int written = snprintf(path + len, size - len, i ? ";%s" : "%s", label ? label : "?");
+        if (written < 0)
+            break;
+        len += (size_t)written;
+    }
+}
+
+// Scopes open before a gap may have ended in it, forget them: their END (if any) is
+// dropped instead of closing a span with the wrong start. A gap on the shared ring
+// can be any thread's.
+static void reset_thread_stacks(const trace_event_t *event)
 {
-    if (!event || !event->data[0])
+    if (event->session >= TRACE_SESSION_MAX)
         return;
 
     pthread_mutex_lock(&adapter_mutex);
-    thread_stack_t *ts = get_thread_stack(event->thread_id);
-    if (!ts)
+    if (event->thread_index == TRACE_THREAD_NONE)
     {
-        pthread_mutex_unlock(&adapter_mutex);
-        return;
+        for (uint32_t i = 0; i < TRACE_THREAD_MAX; ++i)
+            memset(thread_stacks[event->session][i].stack, 0, sizeof(thread_stacks[event->session][i].stack));
     }
-
-    if (ts->stack_top >= 0 && strcmp(ts->stack[ts->stack_top].label, event->data) == 0)
+    else
     {
-        stack_entry_t popped = ts->stack[ts->stack_top--];
-
-        trace_span_t span = {
-            .start_timestamp = popped.start_timestamp,
-            .end_timestamp = event->timestamp,
-            .thread_id = event->thread_id};
+        memset(thread_stacks[event->session][event->thread_index].stack, 0, sizeof(thread_stacks[0][0].stack));
+    }
+    pthread_mutex_unlock(&adapter_mutex);
+}
 
-        snprintf(span.full_path, sizeof(span.full_path), "%s", popped.full_path);
+// Events say what they are and how deep they are, so pairing is a lookup at the
+// event's depth: a lost event only affects its own scope, the next one at that depth
+// starts clean.
+void stack_trace_event_handler(const trace_event_t *event)
+{
+    if (event && event->kind == TRACE_EVENT_GAP)
+    {
+        reset_thread_stacks(event);
+        return;
+    }
+    if (!event || event->callsite_id == TRACE_CALLSITE_NONE || event->depth >= MAX_STACK_DEPTH ||
+        event->kind == TRACE_EVENT_INSTANT)
+        return;
 
+    pthread_mutex_lock(&adapter_mutex);
+    thread_stack_t *ts = get_thread_stack(event);
+    if (!ts)
+    {
         pthread_mutex_unlock(&adapter_mutex);
-        notify_handlers(&span);
+        return;
     }
-    else if (ts->stack_top < MAX_STACK_DEPTH - 1)
+
+    stack_entry_t *entry = &ts->stack[event->depth];
+    uint64_t address = event->arg_count ? event->args[0].u : 0;
+    const char *label;
+    trace_span_t span;
+    switch (event->kind)
     {
-        ts->stack_top++;
-        stack_entry_t *entry = &ts->stack[ts->stack_top];
-        snprintf(entry->label, sizeof(entry->label), "%s", event->data);
+    case TRACE_EVENT_BEGIN:
+        entry->callsite_id = event->callsite_id;
+        entry->address = address;
+        entry->label = event_label(event);
         entry->start_timestamp = event->timestamp;
+        entry->weight = event->weight;
+        pthread_mutex_unlock(&adapter_mutex);
+        return;
 
-        if (ts->stack_top == 0)
-        {
-            strncpy(entry->full_path, entry->label, sizeof(entry->full_path) - 1);
-        }
-        else
+    case TRACE_EVENT_END:
+        if (entry->callsite_id != event->callsite_id || entry->address != address)
         {
-            // Copy to temp buffer to avoid overlap in snprintf
-            char temp_path[sizeof(entry->full_path)];
-            snprintf(temp_path, sizeof(temp_path), "%s;%s",
-                     ts->stack[ts->stack_top - 1].full_path,
-                     entry->label);
-            memcpy(entry->full_path, temp_path, sizeof(entry->full_path));
+            // Begin lost (ring full), nothing to pair with
+            entry->callsite_id = TRACE_CALLSITE_NONE;
+            entry->label = NULL;
+            pthread_mutex_unlock(&adapter_mutex);
+            return;
         }
-        entry->full_path[sizeof(entry->full_path) - 1] = '\0';
-        pthread_mutex_unlock(&adapter_mutex);
-    }
-    else
-    {
+        span = (trace_span_t){
+            .start_timestamp = entry->start_timestamp,
+            .end_timestamp = event->timestamp,
+            .weight = entry->weight};
+        label = entry->label;
+        entry->callsite_id = TRACE_CALLSITE_NONE;
+        entry->label = NULL;
+        break;
+
+    case TRACE_EVENT_COMPLETE:
+        span = (trace_span_t){
+            .start_timestamp = event->timestamp,
+            .end_timestamp = event->timestamp + event->duration,
+            .weight = event->weight};
+        label = event_label(event);
+        break;
+
+    default:
         pthread_mutex_unlock(&adapter_mutex);
+        return;
     }
+
+    span.thread_id = ts->tid;
+    span.pid = ts->pid;
+    span.thread_index = event->thread_index;
+    span.session = event->session;
+    build_full_path(ts, event->depth, label, span.full_path, sizeof(span.full_path));
+    pthread_mutex_unlock(&adapter_mutex);
+    notify_handlers(&span);
 }
 
 int tracer_adapter_stktrce_init(void)
@@ -0,0 +1,306 @@
+#define _GNU_SOURCE // dladdr(), dl_iterate_phdr()
+
+#include "tracering/autoinst.h"
+#include "tracering/emitter.h"
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// This file must not be compiled with -finstrument-functions, the hooks would call themselves
+#define NO_INSTRUMENT __attribute__((no_instrument_function))
+
+#define MODULE_MAX 128
+#define FUNCTION_MAX 4096 // cached function addresses, power of two
+#define FUNCTION_PROBES 16
+#define EXCLUDE_MAX 64
+
+// Executable or shared library, one callsite each: label and file are its path
+typedef struct
+{
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t base; // load bias, symbol values are relative to it
+    char path[PATH_MAX];
+    trace_callsite_t callsite;
+} module_t;
+
+// What a function address resolved to, module 0 = not traced (excluded or no module)
+typedef struct
+{
+    _Atomic uintptr_t function; // 0 = free, written last
+    uint32_t module;            // index + 1
+    uint64_t offset;
+} function_entry_t;
+
+// Appended under resolve_mutex, read without locking
+static module_t modules[MODULE_MAX];
+static _Atomic uint32_t module_count = 0;
+
+// Filled under resolve_mutex, read without locking
+static function_entry_t functions[FUNCTION_MAX];
+static const function_entry_t untraced = {0}; // functions the cache has no room for
+
+static pthread_mutex_t resolve_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t max_depth = 32;
+static char *exclude[EXCLUDE_MAX];
+static uint32_t exclude_count = 0;
+
+// Calls nested on this thread, whether or not they were traced, and which of them
+// emitted a BEGIN and so owe an END
+static _Thread_local uint32_t call_depth = 0;
+static _Thread_local uint64_t emitted[TRACER_AUTOINST_MAX_DEPTH / 64];
+
+// Module holding `function`, looked up by dl_iterate_phdr()
+typedef struct
+{
+    uintptr_t function;
+    int found;
+    module_t module;
+} module_search_t;
+
+// Runs under the loader's lock: must not take resolve_mutex
+NO_INSTRUMENT static int search_module(struct dl_phdr_info *info, size_t size, void *data)
+{
+    (void)size;
+    module_search_t *search = data;
+
+    uintptr_t start = UINTPTR_MAX, end = 0;
+    for (int i = 0; i < info->dlpi_phnum; ++i)
+    {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X))
+            continue;
+        uintptr_t segment = info->dlpi_addr + phdr->p_vaddr;
+        if (segment < start)
+            start = segment;
+        if (segment + phdr->p_memsz > end)
+            end = segment + phdr->p_memsz;
+    }
+    if (search->function < start || search->function >= end)
+        return 0;
+
+    module_t *module = &search->module;
+    module->start = start;
+    module->end = end;
+    module->base = info->dlpi_addr;
+    if (info->dlpi_name && info->dlpi_name[0])
+    {
+        strncpy(module->path, info->dlpi_name, sizeof(module->path) - 1);
+        module->path[sizeof(module->path) - 1] = '\0';
+    }
+    else
+    {
+        // The executable has no name here
+        ssize_t len = readlink("/proc/self/exe", module->path, sizeof(module->path) - 1);
+        module->path[len > 0 ? len : 0] = '\0';
+    }
+    search->found = 1;
+    return 1;
+}
+
+NO_INSTRUMENT static uint32_t find_module(uintptr_t function)
+{
+    uint32_t count = atomic_load_explicit(&module_count, memory_order_acquire);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (function >= modules[i].start && function < modules[i].end)
+            return i + 1;
+    }
+    return 0;
+}
+
+// Under resolve_mutex: adds a module found by search_module(), returns its index + 1,
+// 0 if the table is full
+NO_INSTRUMENT static uint32_t add_module(const module_t *found)
+{
+    uint32_t count = atomic_load_explicit(&module_count, memory_order_relaxed);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (modules[i].start == found->start)
+            return i + 1; // added by another thread meanwhile
+    }
+    if (count == MODULE_MAX)
+        return 0;
+
+    module_t *module = &modules[count];
+    *module = *found;
+    module->callsite = (trace_callsite_t){
+        .label = module->path,
+        .file = module->path,
+        .function = "",
+        .arg_types = "u",
+        .value_kind = TRACE_VALUE_FUNCTION};
+
+    atomic_store_explicit(&module_count, count + 1, memory_order_release);
+    return count + 1;
+}
+
+// Under resolve_mutex, `symbol` is the function's name from dladdr() or NULL
+NO_INSTRUMENT static int is_excluded(const char *symbol)
+{
+    if (!symbol)
+        return 0;
+
+    for (uint32_t i = 0; i < exclude_count; ++i)
+    {
+        size_t len = strlen(exclude[i]);
+        int prefix = len && exclude[i][len - 1] == '*';
+        if (prefix ? strncmp(symbol, exclude[i], len - 1) == 0 : strcmp(symbol, exclude[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+NO_INSTRUMENT static uint32_t function_hash(uintptr_t function)
+{
+    uint64_t h = (uint64_t)function * 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(h >> 32) & (FUNCTION_MAX - 1);
+}
+
+// First call of a function: find its module (rescanning for libraries loaded since)
+// and its name, then check the exclusion list and cache the result. dl_iterate_phdr()
+// and dladdr() take the loader's lock, which is held while instrumented library
+// constructors run: they are called before taking resolve_mutex, never under it.
+NO_INSTRUMENT static const function_entry_t *resolve_function(uintptr_t function)
+{
+    module_search_t search = {function, 0, {0}};
+    uint32_t module = find_module(function);
+    if (!module)
+        dl_iterate_phdr(search_module, &search);
+
+    Dl_info info;
+    const char *symbol = NULL;
+    if ((module || search.found) && dladdr((void *)function, &info) && info.dli_sname &&
+        info.dli_saddr == (void *)function)
+        symbol = info.dli_sname;
+
+    pthread_mutex_lock(&resolve_mutex);
+
+    uint32_t i = function_hash(function);
+    function_entry_t *entry = NULL;
+    for (uint32_t n = 0; n < FUNCTION_PROBES; ++n, i = (i + 1) & (FUNCTION_MAX - 1))
+    {
+        uintptr_t cached = atomic_load_explicit(&functions[i].function, memory_order_relaxed);
+        if (cached == function)
+        {
+            pthread_mutex_unlock(&resolve_mutex);
+            return &functions[i]; // another thread got here first
+        }
+        if (cached == 0)
+        {
+            entry = &functions[i];
+            break;
+        }
+    }
+    if (!entry)
+    {
+        pthread_mutex_unlock(&resolve_mutex);
+        return &untraced;
+    }
+
+    if (!module && search.found)
+        module = add_module(&search.module);
+    if (module && is_excluded(symbol))
+        module = 0;
+
+    entry->module = module;
+    entry->offset = module ? function - modules[module - 1].base : 0;
+    atomic_store_explicit(&entry->function, function, memory_order_release);
+
+    pthread_mutex_unlock(&resolve_mutex);
+    return entry;
+}
+
+// With the function's probe window full it is not traced, rather than resolved again
+// on every call
+NO_INSTRUMENT static inline const function_entry_t *lookup_function(uintptr_t function)
+{
+    uint32_t i = function_hash(function);
+    for (uint32_t n = 0; n < FUNCTION_PROBES; ++n, i = (i + 1) & (FUNCTION_MAX - 1))
+    {
+        uintptr_t cached = atomic_load_explicit(&functions[i].function, memory_order_acquire);
+        if (cached == function)
+            return &functions[i];
+        if (cached == 0)
+            return resolve_function(function);
+    }
+    return &untraced;
+}
+
+NO_INSTRUMENT static void emit_function(void *function, trace_event_kind_t kind)
+{
+    const function_entry_t *entry = lookup_function((uintptr_t)function);
+    if (!entry->module)
+        return;
+
+    trace_event_t event;
+    event.callsite_id = tracer_callsite_id(&modules[entry->module - 1].callsite);
+    tracer_set_kind(&event, kind);
+    event.args[0].u = entry->offset;
+    event.arg_count = 1;
+    if (kind == TRACE_EVENT_BEGIN)
+        tracer_emit_begin(&event);
+    else
+        tracer_emit_end(&event);
+}
+
+NO_INSTRUMENT void __cyg_profile_func_enter(void *function, void *call_site)
+{
+    (void)call_site;
+
+    uint32_t depth = call_depth++;
+    if (depth >= TRACER_AUTOINST_MAX_DEPTH)
+        return;
+
+    uint64_t bit = 1ull << (depth % 64);
+    emitted[depth / 64] &= ~bit;
+    if (__builtin_expect(!tracer_enabled(), 1) || depth >= max_depth)
+        return;
+
+    emit_function(function, TRACE_EVENT_BEGIN);
+    emitted[depth / 64] |= bit;
+}
+
+NO_INSTRUMENT void __cyg_profile_func_exit(void *function, void *call_site)
+{
+    (void)call_site;
+
+    if (call_depth == 0)
+        return; // entered before this thread's counting started
+    uint32_t depth = --call_depth;
+    if (depth >= TRACER_AUTOINST_MAX_DEPTH || !(emitted[depth / 64] & (1ull << (depth % 64))))
+        return;
+
+    emit_function(function, TRACE_EVENT_END);
+}
+
+int tracer_autoinst_config(const tracer_autoinst_config_t *config)
+{
+    if (!config || config->max_depth > TRACER_AUTOINST_MAX_DEPTH || config->exclude_count > EXCLUDE_MAX ||
+        (config->exclude_count && !config->exclude))
+        return -1;
+
+    pthread_mutex_lock(&resolve_mutex);
+    max_depth = config->max_depth;
+    for (uint32_t i = 0; i < exclude_count; ++i)
+        free(exclude[i]);
+    exclude_count = 0;
+    for (uint32_t i = 0; i < config->exclude_count; ++i)
+    {
+        if (config->exclude[i] && (exclude[exclude_count] = strdup(config->exclude[i])))
+            exclude_count++;
+    }
+
+    // Functions already seen are checked again against the new list
+    for (uint32_t i = 0; i < FUNCTION_MAX; ++i)
+        atomic_store_explicit(&functions[i].function, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&resolve_mutex);
+    return 0;
+}
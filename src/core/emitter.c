@@ -2,45 +2,974 @@
 #define _GNU_SOURCE
 
 #include "tracering/emitter.h"
+#include "tracering/backpressure.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <sys/mman.h>
-#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "../internal/buffer.h"
+#include "../internal/category.h"
+#include "../internal/clock.h"
+#include "../internal/futex.h"
+#include "../internal/segment.h"
+
+static trace_shm_header_t *shared = NULL;
+static size_t shared_size = 0;
+static unsigned int map_obtained = 0;
+static trace_clock_source_t clock_source = TRACE_CLOCK_MONOTONIC;
+
+// Points at the segment's enable mask while attached
+static uint64_t detached_mask = 0;
+uint64_t *tracer_enable_mask = &detached_mask;
+
+// Ring geometry, copied from the header when the segment is mapped
+static uint32_t ring_capacity = 0;
+static uint32_t ring_count = 0;
+
+#define BACKPRESSURE_WAIT_NS 10000000 // 10ms, blocked emitters check the receiver is still there
+
+// Flight recorder: without a receiver the segment is built in this process's anonymous
+// memory in overwrite mode, so emitting works exactly as with a receiver that never
+// reads. Dump paths are formatted in advance, the signal handlers only open, write and
+// rename.
+#define FLIGHT_RING_COUNT 16
+#define FLIGHT_PAYLOAD_MAX 1024 // bytes
 
-#ifndef TRACER_ALLOW_OVERWRITE
-#define TRACER_ALLOW_OVERWRITE 0
-#endif
+static int flight = 0;
+static int flight_default_path = 0; // "tracering-<pid>.flight", formatted again in a forked child
+static char flight_path[PATH_MAX];
+static char flight_tmp_path[PATH_MAX + 4];
+static int flight_signal = 0;
+static atomic_flag flight_dumping = ATOMIC_FLAG_INIT;
+
+static const int flight_fatal_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+#define FLIGHT_FATAL_COUNT (sizeof(flight_fatal_signals) / sizeof(flight_fatal_signals[0]))
+static struct sigaction flight_previous[FLIGHT_FATAL_COUNT];
+static struct sigaction flight_signal_previous;
 
 // Very nonportable helper functions
-static inline uint64_t get_timestamp_ns()
+static inline uint64_t get_timestamp()
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    switch (clock_source)
+    {
+    case TRACE_CLOCK_TSC:
+        return clock_read_tsc(); // raw ticks, converted by the receiver
+    case TRACE_CLOCK_MONOTONIC_COARSE:
+        return clock_read_ns(CLOCK_MONOTONIC_COARSE);
+    case TRACE_CLOCK_MANUAL:
+        return atomic_load_explicit(&shared->clock_manual_ns, memory_order_relaxed);
+    default:
+        return clock_read_ns(CLOCK_MONOTONIC);
+    }
 }
 static inline pid_t get_thread_id()
 {
     return syscall(SYS_gettid);
 }
 
-static trace_shared_buffer_t *shared = NULL;
+// Registry index of the calling thread, 0 until the thread emits its first event
+static _Thread_local uint32_t thread_index = 0;
+
+// Set when the registry was full at the thread's first event: it stays unregistered
+// rather than scanning the registry again on every event
+static _Thread_local int thread_registration_failed = 0;
+
+// Serializes callsite registration within this process so each callsite is
+// registered once even if several threads reach it at the same time.
+static pthread_mutex_t callsite_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Callsites and categories registered with the current segment, their ids and bits are
+// cleared at shutdown (both lists under callsite_mutex)
+static trace_callsite_t *registered_callsites = NULL;
+static trace_category_t *registered_categories = NULL;
+
+// Per-thread staging buffer used when batching is enabled. Staged events are
+// published with a single reservation on the shared write index.
+typedef struct
+{
+    trace_event_t events[TRACER_BATCH_MAX];
+    unsigned int count;
+    unsigned int batch_size; // 0 = batching disabled
+    unsigned int depth;      // TRACE scope nesting, flush when the outermost scope ends
+} trace_stage_t;
+
+static _Thread_local trace_stage_t stage;
+
+// Minimum duration filter, in clock units, 0 when off
+static uint64_t min_duration = 0;
+
+// Begin events of the innermost TRACE scopes, held back until the scope lasts at least
+// min_duration or something is emitted inside it. TRACE_COMPLETE scopes have a single
+// event at the end: for them the stack keeps the number of events the thread had
+// emitted when they began, a short one is only left out if it didn't change.
+typedef struct
+{
+    trace_event_t events[TRACER_HOLD_MAX];
+    unsigned int count;
+
+    struct
+    {
+        unsigned int depth; // scope nesting inside the TRACE_COMPLETE scope
+        uint64_t emitted;
+    } complete[TRACER_HOLD_MAX];
+    unsigned int complete_count;
+    uint64_t emitted; // events emitted by the thread, only counted while filtering
+} trace_held_t;
+
+static _Thread_local trace_held_t held;
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+// Ring the calling thread publishes to (its own single-producer ring, or the shared
+// ring), and the last read index it observed there
+static _Thread_local trace_ring_t *thread_ring = NULL;
+static _Thread_local unsigned int thread_ring_read = 0;
+
+// Start and timestamp of the last record written to the thread's own ring, the next
+// one's timestamp is a delta from it. Not synced until the first record, which
+// carries a full timestamp.
+static _Thread_local unsigned int thread_ring_last = 0;
+static _Thread_local uint64_t thread_ring_timestamp = 0;
+static _Thread_local int thread_ring_synced = 0;
+
+// Overwrite mode: the thread's records before this boundary were counted as overwritten
+// already, see count_overwritten()
+static _Thread_local unsigned int thread_ring_lost = 0;
+
+// Receiver sleep epoch seen by the thread's last wake-up check, see notify_receiver()
+static _Thread_local unsigned int notify_epoch = 0;
+
+// The calling thread's counters, copied to its registry entry by publish_stats()
+typedef struct
+{
+    uint64_t emitted;
+    uint64_t dropped;
+    uint64_t overwritten;
+    uint64_t filtered;
+    uint64_t index_writes;
+    unsigned int unpublished; // events counted since the last copy
+} trace_stats_t;
+
+static _Thread_local trace_stats_t stats;
+
+// Full-ring policy, refreshed from the header every time the counters are published
+static _Thread_local unsigned int thread_policy = TRACE_BACKPRESSURE_DROP;
+
+// Weight given to the calling thread's events, the product of the enclosing sampled
+// scopes' rates, 0 inside a scope that was sampled out
+static _Thread_local uint32_t sample_weight = 1;
+
+// Rate for adaptive sampling, updated from the ring occupancy seen at publish time
+static _Thread_local uint32_t sample_rate = 1;
+
+static inline void update_sample_rate(unsigned int used)
+{
+    if (used >= ring_capacity - ring_capacity / 8)
+        sample_rate = 64;
+    else if (used >= ring_capacity - ring_capacity / 4)
+        sample_rate = 16;
+    else if (used >= ring_capacity / 2)
+        sample_rate = 4;
+    else
+        sample_rate = 1;
+}
+
+#define PUBLISH_RECORDS_MAX TRACER_BATCH_MAX // records laid out per reservation
+
+// Units of the record of `event` with these TRACE_RECORD_* flags
+static inline uint32_t record_size(const trace_event_t *event, uint32_t flags, uint32_t payload_size)
+{
+    uint32_t size = 2;
+    if (flags & TRACE_RECORD_TIMESTAMP)
+        size++;
+    if (flags & TRACE_RECORD_EXT)
+        size++;
+    if (event->kind == TRACE_EVENT_COMPLETE)
+        size++;
+    else
+        size += event->arg_count < TRACE_ARGS_MAX ? event->arg_count : TRACE_ARGS_MAX;
+    if (flags & TRACE_RECORD_PAYLOAD)
+        size += 1 + (payload_size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    return size;
+}
+
+// Points the directory entries of the block starts inside [pos, pos + size) at the
+// first record boundary at or after them
+static inline void mark_blocks(trace_ring_t *ring, unsigned int pos, uint32_t size)
+{
+    unsigned int start = (pos + TRACE_RING_BLOCK - 1) & ~(TRACE_RING_BLOCK - 1u);
+    if ((int)(start - (pos + size)) >= 0)
+        return; // no block starts inside, the common case
+
+    atomic_uint *blocks = trace_ring_blocks(ring, ring_capacity);
+    unsigned int mask = ring_capacity / TRACE_RING_BLOCK - 1;
+    for (; (int)(start - (pos + size)) < 0; start += TRACE_RING_BLOCK)
+        atomic_store_explicit(&blocks[(start / TRACE_RING_BLOCK) & mask], start == pos ? pos : pos + size,
+                              memory_order_relaxed);
+}
+
+// Writes the record laid out by record_size() at `pos`, the header last. The timestamp
+// delta is from `previous`.
+static void write_record(trace_ring_t *ring, unsigned int pos, uint32_t size, uint32_t flags,
+                         const trace_event_t *event, uint64_t previous, const void *data, uint32_t payload_size)
+{
+    unsigned int mask = ring_capacity - 1;
+    uint64_t *units = ring->units;
+    unsigned int i = pos + 1;
+
+    uint32_t delta = flags & TRACE_RECORD_TIMESTAMP ? 0 : (uint32_t)(event->timestamp - previous);
+    units[i++ & mask] = event->callsite_id | (uint64_t)delta << 32;
+    if (flags & TRACE_RECORD_TIMESTAMP)
+        units[i++ & mask] = event->timestamp;
+    if (flags & TRACE_RECORD_EXT)
+        units[i++ & mask] = event->weight | (uint64_t)event->depth << 32 | (uint64_t)event->thread_index << 48;
+
+    uint32_t arg_count = 0;
+    if (event->kind == TRACE_EVENT_COMPLETE)
+        units[i++ & mask] = event->duration;
+    else
+    {
+        arg_count = event->arg_count < TRACE_ARGS_MAX ? event->arg_count : TRACE_ARGS_MAX;
+        for (uint32_t a = 0; a < arg_count; ++a)
+            units[i++ & mask] = event->args[a].u;
+    }
+
+    if (flags & TRACE_RECORD_PAYLOAD)
+    {
+        units[i++ & mask] = payload_size;
+        // The payload may wrap around the end of the ring
+        size_t first = (size_t)(ring_capacity - (i & mask)) * sizeof(uint64_t);
+        if (first > payload_size)
+            first = payload_size;
+        memcpy(&units[i & mask], data, first);
+        memcpy(units, (const char *)data + first, payload_size - first);
+    }
+
+    mark_blocks(ring, pos, size);
+    uint32_t depth = event->depth < TRACE_RECORD_DEPTH_EXT ? event->depth : TRACE_RECORD_DEPTH_EXT;
+    __atomic_store_n(&units[pos & mask], trace_record_header(pos, size, event->kind, arg_count, flags, depth),
+                     __ATOMIC_RELEASE);
+}
+
+static int receiver_alive(void)
+{
+    return !atomic_load_explicit(&shared->receiver_closed, memory_order_relaxed) &&
+           !(kill((pid_t)shared->receiver_pid, 0) == -1 && errno == ESRCH);
+}
+
+// Called when `ring` is full, `read` being the last read index seen. Returns nonzero
+// to try again once the receiver may have freed space, 0 to drop the events.
+// `since` is 0 on the first call for a given set of events.
+static int backoff(trace_ring_t *ring, unsigned int read, uint64_t *since)
+{
+    switch (thread_policy)
+    {
+    case TRACE_BACKPRESSURE_SPIN:
+    {
+        uint64_t now = clock_read_ns(CLOCK_MONOTONIC);
+        if (!*since)
+            *since = now;
+        if (now - *since >= shared->backpressure_spin_ns)
+            return 0;
+        cpu_relax();
+        return 1;
+    }
+    case TRACE_BACKPRESSURE_YIELD:
+        if (!receiver_alive())
+            return 0;
+        sched_yield();
+        return 1;
+    case TRACE_BACKPRESSURE_BLOCK:
+        if (!receiver_alive())
+            return 0;
+        // The receiver wakes the ring's read index after draining if it sees a waiter,
+        // or the index has already moved and the wait returns right away
+        atomic_fetch_add_explicit(&ring->waiters, 1, memory_order_seq_cst);
+        futex_wait(&ring->read_index, read, BACKPRESSURE_WAIT_NS);
+        atomic_fetch_sub_explicit(&ring->waiters, 1, memory_order_relaxed);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Overwrite mode: counts the records from `from` (a record boundary) to `end` as
+// overwritten, they are unread and about to be written over. A record still being
+// written by another producer ends the count. Returns the boundary after the last one.
+static unsigned int count_overwritten(trace_ring_t *ring, unsigned int from, unsigned int end)
+{
+    unsigned int mask = ring_capacity - 1;
+    while ((int)(end - from) > 0)
+    {
+        uint64_t header = __atomic_load_n(&ring->units[from & mask], __ATOMIC_ACQUIRE);
+        uint32_t size = TRACE_RECORD_SIZE(header);
+        if (TRACE_RECORD_STAMP(header) != from + 1 || size < TRACE_RECORD_MIN)
+            break;
+        stats.overwritten++;
+        from += size;
+    }
+    return from;
+}
+
+// Shared ring: reserves contiguous units for up to `count` records, whose ends
+// (relative to the first one's start) are in `ends`, with a single atomic operation.
+// At least `min` records, returns the number reserved, 0 if not even `min` fit, and
+// the first one's index in `write_index`.
+static unsigned int reserve_shared(trace_ring_t *ring, const uint32_t *ends, unsigned int count, unsigned int min,
+                                   unsigned int *write_index)
+{
+    if (thread_policy == TRACE_BACKPRESSURE_OVERWRITE)
+    {
+        unsigned int units = ends[count - 1];
+        *write_index = atomic_fetch_add_explicit(&ring->emit_write_index, units, memory_order_acq_rel);
+        stats.index_writes++;
+
+        unsigned int read = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+        unsigned int used = *write_index + units - read;
+        if (used > ring_capacity)
+        {
+            // Units before the oldest one still in the ring were counted by their claimer,
+            // resume at the first record boundary after it
+            unsigned int oldest = *write_index - ring_capacity;
+            unsigned int end = oldest + units;
+            count_overwritten(ring, (int)(oldest - read) > 0 ? trace_ring_resync(ring, ring_capacity, oldest, end) : read,
+                              end);
+        }
+        update_sample_rate(used);
+        return count;
+    }
+
+    // Only claim units the receiver has already consumed
+    uint64_t since = 0;
+    unsigned int index = atomic_load_explicit(&ring->emit_write_index, memory_order_relaxed);
+    for (;;)
+    {
+        unsigned int read = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+        unsigned int used = index - read;
+        if (used + ends[min - 1] > ring_capacity)
+        {
+            if (!backoff(ring, read, &since))
+                return 0;
+            index = atomic_load_explicit(&ring->emit_write_index, memory_order_relaxed);
+            continue;
+        }
+        unsigned int fit = count;
+        while (used + ends[fit - 1] > ring_capacity)
+            fit--; // keep the oldest events, the rest waits or is dropped
+        if (atomic_compare_exchange_weak_explicit(&ring->emit_write_index, &index, index + ends[fit - 1],
+                                                  memory_order_acq_rel, memory_order_relaxed))
+        {
+            stats.index_writes++;
+            update_sample_rate(used + ends[fit - 1]);
+            *write_index = index;
+            return fit;
+        }
+    }
+}
+
+// Shared ring, overwrite mode: a producer preempted after its reservation may find it
+// already lapped, writing it now would tear later records under the receiver
+static inline int shared_lapped(trace_ring_t *ring, unsigned int write_index)
+{
+    return thread_policy == TRACE_BACKPRESSURE_OVERWRITE &&
+           atomic_load_explicit(&ring->emit_write_index, memory_order_relaxed) - write_index > ring_capacity;
+}
+
+// Shared ring: records always carry the timestamp and the thread index, several
+// producers write it. Returns the number of events actually published.
+static unsigned int publish_shared(trace_ring_t *ring, const trace_event_t *events, unsigned int count)
+{
+    const uint32_t flags = TRACE_RECORD_TIMESTAMP | TRACE_RECORD_EXT;
+    uint32_t ends[PUBLISH_RECORDS_MAX];
+    if (count > PUBLISH_RECORDS_MAX)
+        count = PUBLISH_RECORDS_MAX;
+    for (unsigned int i = 0, end = 0; i < count; ++i)
+        ends[i] = end += record_size(&events[i], flags, 0);
+    while (count > 1 && ends[count - 1] > ring_capacity / 2)
+        count--; // a reservation never laps itself
+
+    unsigned int write_index;
+    count = reserve_shared(ring, ends, count, 1, &write_index);
+    if (count && shared_lapped(ring, write_index))
+        return count; // overwritten already
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        unsigned int start = i ? ends[i - 1] : 0;
+        write_record(ring, write_index + start, ends[i] - start, flags, &events[i], 0, NULL, 0);
+    }
+
+    // Only informational on the shared ring (occupancy), the headers publish the records
+    if (count)
+    {
+        atomic_store_explicit(&ring->rec_write_index, write_index + ends[count - 1], memory_order_release);
+        stats.index_writes++;
+    }
+    return count;
+}
+
+// Per-thread ring: this thread is the only producer, the records start at its own
+// write index. Same contract as reserve_shared().
+static unsigned int reserve_own(trace_ring_t *ring, unsigned int write_index, const uint32_t *ends,
+                                unsigned int count, unsigned int min)
+{
+    // Only look at the receiver's read index when the cached one says we're full
+    if (write_index - thread_ring_read + ends[count - 1] > ring_capacity)
+    {
+        uint64_t since = 0;
+        unsigned int used;
+        for (;;)
+        {
+            thread_ring_read = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+            used = write_index - thread_ring_read;
+            if (used + ends[min - 1] <= ring_capacity || thread_policy == TRACE_BACKPRESSURE_OVERWRITE)
+                break;
+            if (!backoff(ring, thread_ring_read, &since))
+                return 0;
+        }
+
+        if (thread_policy != TRACE_BACKPRESSURE_OVERWRITE)
+        {
+            while (used + ends[count - 1] > ring_capacity)
+                count--; // keep the oldest events, the rest waits or is dropped
+        }
+        else if (used + ends[count - 1] > ring_capacity)
+        {
+            unsigned int units = ends[count - 1];
+            unsigned int oldest = write_index - ring_capacity, end = oldest + units;
+            unsigned int from = (int)(thread_ring_lost - thread_ring_read) > 0 ? thread_ring_lost : thread_ring_read;
+            if ((int)(oldest - from) > 0) // already written over (a taken over flight recorder ring)
+                from = trace_ring_resync(ring, ring_capacity, oldest, end);
+            thread_ring_lost = count_overwritten(ring, from, end);
+
+            // Unread units are about to be rewritten: claim them first, so the receiver can
+            // tell a copy made meanwhile may be torn
+            atomic_store_explicit(&ring->emit_write_index, write_index + units, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            stats.index_writes++;
+        }
+    }
+    return count;
+}
+
+// Per-thread ring: publishes the records written up to `write_index` with a release
+// store, no read-modify-write
+static void commit_own(trace_ring_t *ring, unsigned int write_index)
+{
+    atomic_store_explicit(&ring->rec_write_index, write_index, memory_order_release);
+    stats.index_writes++;
+
+    // The cached read index only overestimates occupancy, refresh it once that matters
+    if (write_index - thread_ring_read >= ring_capacity / 2)
+        thread_ring_read = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    update_sample_rate(write_index - thread_ring_read);
+}
+
+// Per-thread ring: lays out the records of `events` from `write_index` on. A record
+// carries a full timestamp when it is the first of the thread, when the delta from the
+// previous one doesn't fit, and when it is the first to start in its directory block.
+static void layout_own(const trace_event_t *events, unsigned int count, unsigned int write_index, uint32_t extra,
+                       uint32_t payload_size, uint32_t *ends, uint32_t *flags)
+{
+    unsigned int last = thread_ring_last, end = 0;
+    uint64_t previous = thread_ring_timestamp;
+    int synced = thread_ring_synced;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        unsigned int start = write_index + end;
+        int64_t delta = (int64_t)(events[i].timestamp - previous);
+        flags[i] = extra;
+        if (!synced || delta != (int32_t)delta || (int)((start & ~(TRACE_RING_BLOCK - 1u)) - last) > 0)
+            flags[i] |= TRACE_RECORD_TIMESTAMP;
+        if (events[i].weight != 1 || events[i].depth >= TRACE_RECORD_DEPTH_EXT)
+            flags[i] |= TRACE_RECORD_EXT;
+        ends[i] = end += record_size(&events[i], flags[i], payload_size);
+        last = start;
+        previous = events[i].timestamp;
+        synced = 1;
+    }
+}
+
+// Per-thread ring: writes the first `count` records laid out by layout_own()
+static void write_own(trace_ring_t *ring, const trace_event_t *events, unsigned int count, unsigned int write_index,
+                      const uint32_t *ends, const uint32_t *flags, const void *data, uint32_t payload_size)
+{
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        unsigned int start = write_index + (i ? ends[i - 1] : 0);
+        write_record(ring, start, write_index + ends[i] - start, flags[i], &events[i], thread_ring_timestamp, data,
+                     payload_size);
+        thread_ring_last = start;
+        thread_ring_timestamp = events[i].timestamp;
+        thread_ring_synced = 1;
+    }
+    commit_own(ring, write_index + ends[count - 1]);
+}
+
+static unsigned int publish_own(trace_ring_t *ring, const trace_event_t *events, unsigned int count)
+{
+    uint32_t ends[PUBLISH_RECORDS_MAX], flags[PUBLISH_RECORDS_MAX];
+    if (count > PUBLISH_RECORDS_MAX)
+        count = PUBLISH_RECORDS_MAX;
+
+    unsigned int write_index = atomic_load_explicit(&ring->rec_write_index, memory_order_relaxed);
+    layout_own(events, count, write_index, 0, 0, ends, flags);
+    while (count > 1 && ends[count - 1] > ring_capacity / 2)
+        count--; // a reservation never laps itself
+    count = reserve_own(ring, write_index, ends, count, 1);
+    if (count)
+        write_own(ring, events, count, write_index, ends, flags, NULL, 0);
+    return count;
+}
+
+// One event and its payload in a single record: all or nothing
+static unsigned int publish_record(const trace_event_t *event, const void *data, uint32_t size)
+{
+    uint32_t end, flags;
+    unsigned int write_index;
+    if (thread_ring)
+    {
+        write_index = atomic_load_explicit(&thread_ring->rec_write_index, memory_order_relaxed);
+        layout_own(event, 1, write_index, TRACE_RECORD_PAYLOAD, size, &end, &flags);
+        if (!reserve_own(thread_ring, write_index, &end, 1, 1))
+            return 0;
+        write_own(thread_ring, event, 1, write_index, &end, &flags, data, size);
+        return 1;
+    }
+
+    trace_ring_t *ring = trace_shm_ring(shared, TRACE_RING_SHARED);
+    flags = TRACE_RECORD_TIMESTAMP | TRACE_RECORD_EXT | TRACE_RECORD_PAYLOAD;
+    end = record_size(event, flags, size);
+    if (!reserve_shared(ring, &end, 1, 1, &write_index))
+        return 0;
+    if (shared_lapped(ring, write_index))
+        return 1; // overwritten already
+    write_record(ring, write_index, end, flags, event, 0, data, size);
+    atomic_store_explicit(&ring->rec_write_index, write_index + end, memory_order_release);
+    stats.index_writes++;
+    return 1;
+}
+
+// Whether the thread's own ring held nothing unread before this publish, as far as the
+// cached read index knows
+static inline int ring_was_empty(void)
+{
+    return thread_ring &&
+           atomic_load_explicit(&thread_ring->rec_write_index, memory_order_relaxed) == thread_ring_read;
+}
+
+// The receiver only goes to sleep after finding every ring empty, so the first
+// publish after that is the empty to non-empty transition that has to wake it.
+// The fence pairs with the one in tracer_receiver_wait(): either we see the flag or
+// the receiver sees our events. It is only paid when the ring was empty or the
+// receiver went to sleep since the last check (one relaxed load of a line it rarely
+// writes), a publish racing with that epoch bump wakes it up to a wait slice late.
+static inline void notify_receiver(int was_empty)
+{
+    unsigned int epoch = atomic_load_explicit(&shared->receiver_epoch, memory_order_relaxed);
+    if (!was_empty && epoch == notify_epoch)
+        return;
+    notify_epoch = epoch;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&shared->receiver_sleeping, memory_order_relaxed) &&
+        atomic_exchange_explicit(&shared->receiver_sleeping, 0, memory_order_relaxed))
+    {
+        atomic_fetch_add_explicit(&shared->receiver_doorbell, 1, memory_order_release);
+        futex_wake_all(&shared->receiver_doorbell);
+    }
+}
+
+// Copies the calling thread's counters to its registry entry
+static void publish_stats(void)
+{
+    stats.unpublished = 0;
+    if (!shared || thread_index == TRACE_THREAD_NONE)
+        return;
+
+    trace_thread_entry_t *entry = &shared->threads[thread_index];
+    atomic_store_explicit(&entry->emitted, stats.emitted, memory_order_relaxed);
+    atomic_store_explicit(&entry->dropped, stats.dropped, memory_order_relaxed);
+    atomic_store_explicit(&entry->overwritten, stats.overwritten, memory_order_relaxed);
+    atomic_store_explicit(&entry->filtered, stats.filtered, memory_order_relaxed);
+    atomic_store_explicit(&entry->index_writes, stats.index_writes, memory_order_relaxed);
+}
+
+// Wakes the receiver and counts `published` of `count` events as emitted, the rest as dropped
+static void published_events(unsigned int published, unsigned int count, int was_empty)
+{
+    if (published)
+        notify_receiver(was_empty);
+
+    stats.emitted += published;
+    stats.dropped += count - published;
+    stats.unpublished += count;
+    // Losses are reported right away, the rest only periodically
+    if (published < count || stats.unpublished >= TRACE_THREAD_STATS_INTERVAL)
+        publish_stats();
+}
+
+// Counts events left out by the minimum duration filter
+static void filtered_events(unsigned int count)
+{
+    stats.filtered += count;
+    stats.unpublished += count;
+    if (stats.unpublished >= TRACE_THREAD_STATS_INTERVAL)
+        publish_stats();
+}
+
+static unsigned int publish(const trace_event_t *events, unsigned int count)
+{
+    if (!shared || count == 0)
+        return 0;
+
+    if (stats.unpublished == 0)
+        thread_policy = atomic_load_explicit(&shared->backpressure, memory_order_relaxed);
+
+    // A full ring publishes what fits, waiting policies then wait for room for the rest
+    int was_empty = ring_was_empty();
+    unsigned int published = 0, n;
+    do
+    {
+        n = thread_ring ? publish_own(thread_ring, events + published, count - published)
+                        : publish_shared(trace_shm_ring(shared, TRACE_RING_SHARED), events + published, count - published);
+        published += n;
+    } while (n && published < count);
+    published_events(published, count, was_empty);
+    return published;
+}
+
+// Event with a payload, see publish_record()
+static void publish_payload(const trace_event_t *event, const void *data, uint32_t size)
+{
+    if (stats.unpublished == 0)
+        thread_policy = atomic_load_explicit(&shared->backpressure, memory_order_relaxed);
+    int was_empty = ring_was_empty();
+    published_events(publish_record(event, data, size), 1, was_empty);
+}
+
+// Claims the first registry entry in `state`, returns its index or TRACE_THREAD_NONE
+static uint32_t claim_entry(unsigned int state)
+{
+    for (uint32_t i = 1; i < TRACE_THREAD_MAX; ++i)
+    {
+        unsigned int expected = state;
+        if (atomic_compare_exchange_strong_explicit(&shared->threads[i].state, &expected, TRACE_THREAD_CLAIMED,
+                                                    memory_order_acquire, memory_order_relaxed))
+            return i;
+    }
+    return TRACE_THREAD_NONE;
+}
+
+// Claims a free registry entry for the calling thread, caches its index in TLS
+static uint32_t register_thread(void)
+{
+    if (!shared)
+        return TRACE_THREAD_NONE;
+
+    uint32_t i = claim_entry(TRACE_THREAD_FREE);
+    // No receiver reclaims exited threads in a flight recorder: take over an exited
+    // thread's entry and ring, the events still there are then attributed to this thread
+    if (i == TRACE_THREAD_NONE && flight)
+        i = claim_entry(TRACE_THREAD_EXITED);
+    if (i == TRACE_THREAD_NONE)
+    {
+        thread_registration_failed = 1;
+        return TRACE_THREAD_NONE; // registry full, events are attributed to an unknown thread
+    }
+
+    trace_thread_entry_t *entry = &shared->threads[i];
+    entry->tid = (uint32_t)get_thread_id();
+    entry->pid = (uint32_t)getpid();
+    entry->start_timestamp = get_timestamp();
+    if (pthread_getname_np(pthread_self(), entry->name, sizeof(entry->name)) != 0)
+        entry->name[0] = '\0';
+    snprintf(entry->process_name, sizeof(entry->process_name), "%s", program_invocation_short_name);
+    atomic_store_explicit(&entry->emitted, 0, memory_order_relaxed);
+    atomic_store_explicit(&entry->dropped, 0, memory_order_relaxed);
+    atomic_store_explicit(&entry->overwritten, 0, memory_order_relaxed);
+    atomic_store_explicit(&entry->filtered, 0, memory_order_relaxed);
+    atomic_store_explicit(&entry->index_writes, 0, memory_order_relaxed);
+    atomic_store_explicit(&entry->state, TRACE_THREAD_ACTIVE, memory_order_release);
+
+    thread_index = i;
+    stats = (trace_stats_t){0}; // counters are per registry entry
+    if (i < ring_count)
+    {
+        thread_ring = trace_shm_ring(shared, i);
+        thread_ring_read = atomic_load_explicit(&thread_ring->read_index, memory_order_acquire);
+        thread_ring_synced = 0; // the first record carries a full timestamp
+        thread_ring_lost = thread_ring_read;
+    }
+    pthread_setspecific(thread_key, entry); // any non-NULL value, runs thread_exit()
+    return i;
+}
+
+static void unregister_thread(void)
+{
+    publish_stats();
+    if (shared && thread_index != TRACE_THREAD_NONE)
+        atomic_store_explicit(&shared->threads[thread_index].state, TRACE_THREAD_EXITED, memory_order_release);
+    thread_index = TRACE_THREAD_NONE;
+    thread_registration_failed = 0;
+    thread_ring = NULL;
+}
+
+static void thread_exit(void *arg)
+{
+    (void)arg;
+    tracer_flush();
+    unregister_thread();
+}
+
+static void thread_atfork_child(void)
+{
+    // The child is a new process, its threads must register again
+    thread_index = TRACE_THREAD_NONE;
+    thread_registration_failed = 0;
+    thread_ring = NULL;
+    thread_ring_synced = 0;
+
+    // Its flight recorder is a copy of the parent's, don't dump it over the parent's file
+    if (flight && flight_default_path)
+    {
+        snprintf(flight_path, sizeof(flight_path), "tracering-%d.flight", (int)getpid());
+        snprintf(flight_tmp_path, sizeof(flight_tmp_path), "%s.tmp", flight_path);
+    }
+}
+
+// Writes the flight recorder to `tmp_path` and renames it to `path`, so a dump cut short
+// never replaces a complete one. Async-signal-safe, returns 0 or -1.
+static int flight_write(const char *path, const char *tmp_path)
+{
+    if (atomic_flag_test_and_set_explicit(&flight_dumping, memory_order_acquire))
+        return -1; // another thread is dumping
+
+    int result = -1;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd != -1)
+    {
+        const char *data = (const char *)shared;
+        size_t left = shared_size;
+        while (left)
+        {
+            ssize_t n = write(fd, data, left);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            data += n;
+            left -= (size_t)n;
+        }
+        if (close(fd) == 0 && left == 0 && rename(tmp_path, path) == 0)
+            result = 0;
+        else
+            unlink(tmp_path);
+    }
+
+    atomic_flag_clear_explicit(&flight_dumping, memory_order_release);
+    return result;
+}
+
+static void flight_signal_handler(int sig)
+{
+    (void)sig;
+    int saved_errno = errno;
+    flight_write(flight_path, flight_tmp_path);
+    errno = saved_errno;
+}
+
+// Dumps, then hands the signal to the previous disposition (by default: terminate with
+// a core dump). A fault raised again when the handler returns reaches it too.
+static void flight_fatal_handler(int sig)
+{
+    flight_write(flight_path, flight_tmp_path);
+    for (size_t i = 0; i < FLIGHT_FATAL_COUNT; ++i)
+    {
+        if (flight_fatal_signals[i] == sig)
+            sigaction(sig, &flight_previous[i], NULL);
+    }
+    raise(sig);
+}
+
+static void flight_install_handlers(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_ONSTACK;
+    action.sa_handler = flight_fatal_handler;
+    for (size_t i = 0; i < FLIGHT_FATAL_COUNT; ++i)
+        sigaction(flight_fatal_signals[i], &action, &flight_previous[i]);
+
+    if (flight_signal)
+    {
+        action.sa_flags = SA_RESTART;
+        action.sa_handler = flight_signal_handler;
+        sigaction(flight_signal, &action, &flight_signal_previous);
+    }
+}
+
+static void flight_restore_handlers(void)
+{
+    for (size_t i = 0; i < FLIGHT_FATAL_COUNT; ++i)
+        sigaction(flight_fatal_signals[i], &flight_previous[i], NULL);
+    if (flight_signal)
+        sigaction(flight_signal, &flight_signal_previous, NULL);
+}
+
+// Builds a segment in anonymous memory the way a receiver would, returns it or NULL
+static trace_shm_header_t *flight_create(const tracer_emit_config_t *config, size_t *size)
+{
+    uint32_t capacity = TRACE_RING_CAPACITY_MIN;
+    while (capacity < config->flight_capacity && capacity < TRACE_RING_CAPACITY_MAX)
+        capacity <<= 1;
+
+    *size = segment_size(capacity, FLIGHT_RING_COUNT);
+    trace_shm_header_t *header = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (header == MAP_FAILED)
+        return NULL;
+
+    segment_format(header, *size, capacity, FLIGHT_RING_COUNT, FLIGHT_PAYLOAD_MAX);
+    header->clock_source = TRACE_CLOCK_MONOTONIC;
+    atomic_store_explicit(&header->backpressure, TRACE_BACKPRESSURE_OVERWRITE, memory_order_relaxed);
+    header->receiver_pid = (uint32_t)getpid();
+    header->magic = TRACE_SHM_MAGIC;
+    return header;
+}
+
+// Converts the minimum duration to the units of event timestamps
+static void set_min_duration(uint64_t ns)
+{
+    min_duration = ns;
+    if (clock_source == TRACE_CLOCK_TSC && shared->clock_tsc_mult)
+        min_duration = (uint64_t)(((unsigned __int128)ns << 32) / shared->clock_tsc_mult);
+}
+
+// No receiver: record into a flight recorder if the config asks for one
+static int flight_init(const tracer_emit_config_t *config)
+{
+    size_t size;
+    trace_shm_header_t *header = flight_create(config, &size);
+    if (!header)
+    {
+        perror("mmap failed");
+        return 1;
+    }
+
+    flight_default_path = !config->flight_path;
+    if (flight_default_path)
+        snprintf(flight_path, sizeof(flight_path), "tracering-%d.flight", (int)getpid());
+    else if (snprintf(flight_path, sizeof(flight_path), "%s", config->flight_path) >= (int)sizeof(flight_path))
+    {
+        fprintf(stderr, "tracering: flight recorder path too long\n");
+        munmap(header, size);
+        return 1;
+    }
+    snprintf(flight_tmp_path, sizeof(flight_tmp_path), "%s.tmp", flight_path);
+
+    map_obtained = segment_prepare(-1, header, size, config->map_flags);
+    shared = header;
+    shared_size = size;
+    tracer_enable_mask = (uint64_t *)&shared->enable_mask;
+    ring_capacity = shared->ring_capacity;
+    ring_count = shared->ring_count;
+    clock_source = TRACE_CLOCK_MONOTONIC;
+    set_min_duration(config->min_duration_ns);
+
+    flight = 1;
+    flight_signal = config->flight_signal;
+    flight_install_handlers();
+    return 0;
+}
+
+static void thread_key_create(void)
+{
+    pthread_key_create(&thread_key, thread_exit);
+    pthread_atfork(NULL, NULL, thread_atfork_child);
+}
 
 int tracer_emit_init(void)
 {
-    int fd = shm_open(TRACE_SHM_NAME, O_RDWR, 0666);
-    shared = mmap(NULL, sizeof(trace_shared_buffer_t),
-                  PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (shared == MAP_FAILED)
+    return tracer_emit_init_config(NULL);
+}
+
+int tracer_emit_init_config(const tracer_emit_config_t *config)
+{
+    tracer_emit_config_t defaults = TRACER_EMIT_CONFIG_DEFAULT;
+    if (!config)
+        config = &defaults;
+
+    pthread_once(&thread_key_once, thread_key_create);
+
+    char name[64];
+    if (segment_name(config->session, name, sizeof(name)) != 0)
+    {
+        fprintf(stderr, "tracering: invalid session name \"%s\"\n", segment_session(config->session));
+        return 1;
+    }
+
+    int fd = segment_open(name);
+    if (fd == -1)
+    {
+        if (config->flight_capacity)
+            return flight_init(config);
+        perror("shm_open failed");
+        return 1;
+    }
+
+    // The file is sized before the receiver fills in the header, map all of it and
+    // check the header says it's ready
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(trace_shm_header_t))
+    {
+        fprintf(stderr, "tracering: shared segment not ready\n");
+        close(fd);
+        return 1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    trace_shm_header_t *header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
     {
         perror("mmap failed");
+        close(fd);
+        return 1;
+    }
+
+    uint64_t magic = __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE);
+    if (magic != TRACE_SHM_MAGIC || header->version != TRACE_SHM_VERSION || header->segment_size != size)
+    {
+        fprintf(stderr, "tracering: shared segment not ready or incompatible (version %u, expected %u)\n",
+                header->version, TRACE_SHM_VERSION);
+        munmap(header, size);
+        close(fd);
         return 1;
     }
+
+    map_obtained = segment_prepare(fd, header, size, config->map_flags);
+    close(fd);
+
+    shared = header;
+    shared_size = size;
+    tracer_enable_mask = (uint64_t *)&shared->enable_mask;
+    ring_capacity = shared->ring_capacity;
+    ring_count = shared->ring_count;
+    clock_source = (trace_clock_source_t)shared->clock_source;
+    set_min_duration(config->min_duration_ns);
     return 0;
 }
 
@@ -48,37 +977,408 @@ void tracer_emit_shutdown(void)
 {
     if (shared)
     {
-        munmap(shared, sizeof(trace_shared_buffer_t));
+        tracer_flush();
+        publish_stats();
+
+        // Thread exit handlers don't run for threads still alive at process exit,
+        // mark every thread of this process as exited so the receiver can reclaim them
+        uint32_t pid = (uint32_t)getpid();
+        for (uint32_t i = 1; i < TRACE_THREAD_MAX; ++i)
+        {
+            trace_thread_entry_t *entry = &shared->threads[i];
+            if (atomic_load_explicit(&entry->state, memory_order_acquire) == TRACE_THREAD_ACTIVE && entry->pid == pid)
+                atomic_store_explicit(&entry->state, TRACE_THREAD_EXITED, memory_order_release);
+        }
+        thread_index = TRACE_THREAD_NONE;
+        thread_registration_failed = 0;
+        thread_ring = NULL;
+
+        if (flight)
+        {
+            flight_restore_handlers();
+            flight = 0;
+        }
+
+        // Cached ids and bits refer to this segment's tables, the next one registers them again
+        pthread_mutex_lock(&callsite_mutex);
+        while (registered_callsites)
+        {
+            trace_callsite_t *callsite = registered_callsites;
+            registered_callsites = callsite->next;
+            callsite->next = NULL;
+            __atomic_store_n(&callsite->id, 0, __ATOMIC_RELAXED);
+        }
+        while (registered_categories)
+        {
+            trace_category_t *category = registered_categories;
+            registered_categories = category->next;
+            category->next = NULL;
+            __atomic_store_n(&category->bits, 0, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&callsite_mutex);
+
+        tracer_enable_mask = &detached_mask;
+        munmap(shared, shared_size);
         shared = NULL;
+        map_obtained = 0;
+        clock_source = TRACE_CLOCK_MONOTONIC;
+        min_duration = 0;
 
         // Don't unlink the shared memory here, as it might be used by other processes.
     }
 }
 
+unsigned int tracer_emit_mapping(void)
+{
+    return map_obtained;
+}
+
+int tracer_emit_flight(void)
+{
+    return flight;
+}
+
+int tracer_flight_dump(const char *path)
+{
+    if (!flight)
+        return -1;
+
+    // Events the calling thread still stages would be missing from the dump
+    tracer_flush();
+    publish_stats();
+    if (!path)
+        return flight_write(flight_path, flight_tmp_path);
+
+    char tmp_path[PATH_MAX + 4];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+        return -1;
+    return flight_write(path, tmp_path);
+}
+
 void tracer_set(trace_event_t *event)
 {
-    event->timestamp = get_timestamp_ns();        // Use current time as timestamp
-    event->thread_id = (uint32_t)get_thread_id(); // Get the thread ID
+    tracer_set_kind(event, TRACE_EVENT_INSTANT);
+}
+
+void tracer_set_kind(trace_event_t *event, trace_event_kind_t kind)
+{
+    event->timestamp = get_timestamp(); // Use current time as timestamp
+    event->thread_index = thread_index || thread_registration_failed ? thread_index : register_thread();
+    event->weight = sample_weight;
+    event->arg_count = 0;
+    event->kind = (uint8_t)kind;
+
+    // An END event is emitted while its own scope is still counted
+    unsigned int depth = kind == TRACE_EVENT_END && stage.depth > 0 ? stage.depth - 1 : stage.depth;
+    event->depth = depth < UINT16_MAX ? (uint16_t)depth : UINT16_MAX;
+}
+
+// Publishes the held begin events, something is being emitted inside their scopes
+static void release_held(void)
+{
+    unsigned int count = held.count;
+    held.count = 0;
+    tracer_emit_list(held.events, count);
 }
 
 void tracer_emit(const trace_event_t *event)
 {
-    if (!shared)
+    tracer_emit_list(event, 1);
+}
+
+void tracer_emit_payload(const trace_event_t *event, const void *data, uint32_t size)
+{
+    if (!shared || event->weight == 0)
         return;
 
-#if !TRACER_ALLOW_OVERWRITE
-    unsigned int write = atomic_load_explicit(&shared->emit_write_index, memory_order_relaxed);
-    unsigned int read = atomic_load_explicit(&shared->read_index, memory_order_acquire);
+    held.emitted++;
+    if (held.count)
+        release_held();
+
+    // Staged events were emitted first, keep them first
+    if (stage.count)
+        tracer_flush();
 
-    if (write - read >= TRACE_BUFFER_SIZE)
+    if (size > shared->payload_max)
+        size = shared->payload_max;
+    publish_payload(event, data, size);
+}
+
+void tracer_emit_list(const trace_event_t *events, unsigned int count)
+{
+    if (!shared || count == 0 || events[0].weight == 0)
+        return; // weight 0: inside a sampled-out scope
+
+    held.emitted += count;
+    if (held.count)
+        release_held();
+
+    if (stage.batch_size == 0)
     {
-        // Buffer is full and overwriting is not allowed
+        publish(events, count);
         return;
     }
-#endif
-    unsigned int write_index = atomic_fetch_add_explicit(&shared->emit_write_index, 1, memory_order_acq_rel);
-    unsigned int index = write_index & (TRACE_BUFFER_SIZE - 1);
 
-    shared->events[index] = *event;
-    atomic_store_explicit(&shared->rec_write_index, write_index + 1, memory_order_release);
-}
\ No newline at end of file
+    if (stage.count + count > stage.batch_size)
+        tracer_flush();
+
+    if (count > stage.batch_size)
+    {
+        // Larger than a whole batch, publish directly with one reservation
+        publish(events, count);
+        return;
+    }
+
+    for (unsigned int i = 0; i < count; ++i)
+        stage.events[stage.count++] = events[i];
+
+    if (stage.count == stage.batch_size)
+        tracer_flush();
+}
+
+static inline void close_scope(void)
+{
+    if (stage.depth > 0 && --stage.depth == 0 && stage.count > 0)
+        tracer_flush();
+}
+
+void tracer_emit_begin(const trace_event_t *event)
+{
+    stage.depth++;
+    if (min_duration && event->weight && held.count < TRACER_HOLD_MAX)
+        held.events[held.count++] = *event;
+    else
+        tracer_emit_list(event, 1);
+}
+
+void tracer_emit_end(const trace_event_t *event)
+{
+    // Still held: nothing was emitted inside the scope, both events go or neither does
+    const trace_event_t *begin = held.count ? &held.events[held.count - 1] : NULL;
+    if (begin && begin->depth == event->depth && begin->callsite_id == event->callsite_id)
+    {
+        if (event->timestamp - begin->timestamp < min_duration)
+        {
+            held.count--;
+            filtered_events(2);
+            close_scope();
+            return;
+        }
+        release_held();
+    }
+
+    tracer_emit_list(event, 1);
+    close_scope();
+}
+
+void tracer_complete_begin(trace_event_t *event)
+{
+    tracer_set_kind(event, TRACE_EVENT_COMPLETE);
+    stage.depth++;
+    if (min_duration && event->weight && held.complete_count < TRACER_HOLD_MAX)
+    {
+        held.complete[held.complete_count].depth = stage.depth;
+        held.complete[held.complete_count++].emitted = held.emitted;
+    }
+}
+
+void tracer_complete_end(trace_event_t *event)
+{
+    event->duration = get_timestamp() - event->timestamp; // clock units, converted by the receiver
+
+    // Left out if short and nothing was emitted inside it, whose parent it is
+    if (held.complete_count && held.complete[held.complete_count - 1].depth == stage.depth)
+    {
+        uint64_t emitted = held.complete[--held.complete_count].emitted;
+        if (event->duration < min_duration && emitted == held.emitted)
+        {
+            filtered_events(1);
+            close_scope();
+            return;
+        }
+    }
+    tracer_emit_end(event);
+}
+
+void tracer_flush(void)
+{
+    if (stage.count == 0)
+        return;
+
+    publish(stage.events, stage.count);
+    stage.count = 0;
+}
+
+void tracer_emit_set_batch_size(unsigned int batch_size)
+{
+    tracer_flush();
+
+    if (batch_size > TRACER_BATCH_MAX)
+        batch_size = TRACER_BATCH_MAX;
+    stage.batch_size = batch_size > 1 ? batch_size : 0;
+
+    // Registering makes sure anything still staged when the thread exits gets published
+    if (!thread_index && !thread_registration_failed)
+        register_thread();
+}
+
+uint32_t tracer_sample(uint32_t *counter, uint32_t n)
+{
+    if (sample_weight == 0)
+        return 0;
+    if (n <= 1)
+        return 1;
+    if (++*counter < n)
+        return 0;
+    *counter = 0;
+    return n;
+}
+
+uint32_t tracer_sample_begin(uint32_t weight)
+{
+    uint32_t previous = sample_weight;
+    uint64_t product = (uint64_t)previous * weight;
+    sample_weight = product > UINT32_MAX ? UINT32_MAX : (uint32_t)product;
+    return previous;
+}
+
+void tracer_sample_end(uint32_t previous)
+{
+    sample_weight = previous;
+}
+
+uint32_t tracer_sample_adaptive_rate(void)
+{
+    return flight ? 1 : sample_rate; // a flight recorder is always full, there is no receiver to keep up with
+}
+
+// Copies a string into the shared string table, returns its offset or 0 ("?") if the table is full
+static uint32_t strtab_add(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    unsigned int offset = atomic_fetch_add_explicit(&shared->strtab_used, (unsigned int)len, memory_order_relaxed);
+    if (offset + len > TRACE_STRTAB_SIZE)
+        return 0;
+
+    memcpy(&shared->strtab[offset], str, len);
+    return offset;
+}
+
+// Takes the next callsite registry entry and fills it in, returns its id or TRACE_CALLSITE_OVERFLOW
+static uint32_t add_callsite(const trace_callsite_t *callsite)
+{
+    uint32_t id = atomic_fetch_add_explicit(&shared->callsite_count, 1, memory_order_relaxed);
+    if (id >= TRACE_CALLSITE_MAX)
+        return TRACE_CALLSITE_OVERFLOW;
+
+    trace_callsite_entry_t *entry = &shared->callsites[id];
+    entry->label = strtab_add(callsite->label);
+    entry->file = strtab_add(callsite->file);
+    entry->function = strtab_add(callsite->function);
+    entry->line = callsite->line;
+    entry->format = callsite->format ? strtab_add(callsite->format) : 0;
+    snprintf(entry->arg_types, sizeof(entry->arg_types), "%s", callsite->arg_types ? callsite->arg_types : "");
+    entry->value_kind = callsite->value_kind;
+    atomic_store_explicit(&entry->ready, 1, memory_order_release);
+    return id;
+}
+
+uint32_t tracer_callsite_register(trace_callsite_t *callsite)
+{
+    if (!shared)
+        return TRACE_CALLSITE_NONE;
+
+    pthread_mutex_lock(&callsite_mutex);
+
+    uint32_t id = __atomic_load_n(&callsite->id, __ATOMIC_ACQUIRE);
+    if (id)
+    {
+        pthread_mutex_unlock(&callsite_mutex);
+        return id;
+    }
+
+    id = add_callsite(callsite);
+    callsite->next = registered_callsites;
+    registered_callsites = callsite;
+    __atomic_store_n(&callsite->id, id, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&callsite_mutex);
+    return id;
+}
+
+// FNV-1a, never 0 so it can't be mistaken for a free entry
+static uint32_t label_hash(const char *label, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+        hash = (hash ^ (unsigned char)label[i]) * 16777619u;
+    return hash ? hash : 1;
+}
+
+static int label_equals(uint32_t id, const char *label, size_t len)
+{
+    uint32_t offset = shared->callsites[id].label;
+    return offset + len < TRACE_STRTAB_SIZE && memcmp(&shared->strtab[offset], label, len + 1) == 0;
+}
+
+uint32_t tracer_intern(const char *label)
+{
+    if (!shared || !label)
+        return TRACE_CALLSITE_NONE;
+
+    size_t len = strlen(label);
+    uint32_t hash = label_hash(label, len);
+    uint32_t id = TRACE_CALLSITE_NONE; // registered when the label isn't found
+    uint32_t i = hash & (TRACE_INTERN_SLOTS - 1);
+    for (uint32_t n = 0; n < TRACE_INTERN_SLOTS; ++n, i = (i + 1) & (TRACE_INTERN_SLOTS - 1))
+    {
+        uint64_t entry = atomic_load_explicit(&shared->interned[i], memory_order_acquire);
+        if (entry == 0)
+        {
+            // Not interned yet: register a callsite, then try to publish it here. A thread
+            // or process racing us with the same label may win, our callsite then goes unused.
+            if (id == TRACE_CALLSITE_NONE)
+            {
+                trace_callsite_t callsite = {label, "", "", 0, NULL, NULL, TRACE_VALUE_NONE, 0, NULL};
+                id = add_callsite(&callsite);
+                if (id == TRACE_CALLSITE_OVERFLOW || shared->callsites[id].label == 0)
+                    return id; // registry or string table full, can't be found again
+            }
+            if (atomic_compare_exchange_strong_explicit(&shared->interned[i], &entry, (uint64_t)hash << 32 | id,
+                                                        memory_order_acq_rel, memory_order_acquire))
+                return id;
+        }
+        if ((uint32_t)(entry >> 32) == hash && label_equals((uint32_t)entry, label, len))
+            return (uint32_t)entry;
+    }
+    return id ? id : TRACE_CALLSITE_OVERFLOW;
+}
+
+uint64_t tracer_category_register(trace_category_t *category)
+{
+    if (!shared)
+        return TRACE_MASK_UNCATEGORIZED;
+
+    // Racing threads find the same entry, only the first one links the category
+    uint64_t bits = category_bits(shared, category->name);
+    pthread_mutex_lock(&callsite_mutex);
+    if (!__atomic_load_n(&category->bits, __ATOMIC_RELAXED))
+    {
+        category->next = registered_categories;
+        registered_categories = category;
+        __atomic_store_n(&category->bits, bits, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&callsite_mutex);
+    return bits;
+}
+
+void tracer_clock_set(uint64_t ns)
+{
+    if (shared)
+        atomic_store_explicit(&shared->clock_manual_ns, ns, memory_order_relaxed);
+}
+
+void tracer_clock_advance(uint64_t ns)
+{
+    if (shared)
+        atomic_fetch_add_explicit(&shared->clock_manual_ns, ns, memory_order_relaxed);
+}
@@ -1,76 +1,1060 @@
-#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE // syscall(), pthread_setaffinity_np()
 
 #include "tracering/receiver.h"
 #include "tracering/receiver_ex.h"
 #include "../internal/buffer.h"
+#include "../internal/category.h"
+#include "../internal/clock.h"
 #include "../internal/dispatcher.h"
+#include "../internal/format.h"
+#include "../internal/futex.h"
+#include "../internal/segment.h"
+#include "../internal/symbols.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdatomic.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-static trace_shared_buffer_t *shared_buffer = NULL;
-static int shm_fd = -1;
+#define TSC_CALIBRATION_NS 20000000    // 20ms
+#define PROCESS_CHECK_NS 1000000000    // look for dead emitter processes once per second
+#define WAIT_SLICE_NS 100000000        // longest futex sleep, stalled slots and dead processes still get handled
+#define SESSIONS_WAIT_SLICE_NS 1000000 // longest sleep with several sessions without futex_waitv
+
+// A session's segment. Session 0 is created by tracer_receiver_init_config(), the others
+// by tracer_receiver_add_session() with the same configuration, or are flight recorder
+// dumps opened by tracer_receiver_add_dump() (shm_name "", private mapping of the file).
+typedef struct
+{
+    char name[TRACE_SESSION_NAME_MAX]; // "" for the default session
+    char shm_name[64];
+    trace_shm_header_t *buffer;
+    size_t size;
+    int fd;
+    unsigned int map_obtained;
+    uint32_t ring_capacity;
+    uint32_t ring_count;
+    trace_clock_source_t clock_source; // of the emitters, TRACE_CLOCK_TSC uses the calibration below
+    uint64_t last_process_check_ns;
+    bool dump; // a snapshot from tracer_receiver_add_dump(): its pids may be from another boot or host
+
+    // Counters of registry entries already reclaimed
+    trace_thread_stats_t retired_stats;
+
+    // Shared ring record the receiver is waiting on, and since when
+    uint32_t stall_index;
+    uint64_t stall_since_ns;
+
+    // Units of each ring skipped after being lapped, reported before the ring's next event
+    uint64_t lost[TRACE_THREAD_MAX];
+
+    // Raw timestamp of each ring's last record, the next one's delta is from it. Not
+    // synced after skipping records, until a record with a full timestamp.
+    uint64_t base[TRACE_THREAD_MAX];
+    bool synced[TRACE_THREAD_MAX];
+} session_t;
+
+static session_t sessions[TRACE_SESSION_MAX];
+static uint32_t session_count = 0;
+static tracer_receiver_config_t receiver_config;
+
+// Ring geometry of the sessions this receiver creates
+static uint32_t ring_capacity = 0;
+static uint32_t ring_count = 0;
 static dispatcher_t *receiver_dispatcher = NULL;
 
+// Local copy of the clock calibration, used to convert event timestamps to ns
+static trace_clock_source_t clock_source = TRACE_CLOCK_MONOTONIC;
+static uint64_t clock_tsc_base = 0;
+static uint64_t clock_ns_base = 0;
+static uint64_t clock_tsc_mult = 0;
+
+// tracer_receiver_wait() settings
+static trace_wait_strategy_t wait_strategy = TRACE_WAIT_ADAPTIVE;
+static uint64_t wait_spin_ns = 0;
+static int wait_cpu = -1;
+static atomic_bool stop_requested = 0;
+
+// Next event of a ring, held until it is the oldest of all ring heads
+typedef struct
+{
+    trace_event_t event;
+    session_t *session;
+    trace_ring_t *ring;
+    uint32_t read_index;
+    uint32_t size;          // units of the event's record
+    uint32_t payload_index; // unit of the record holding the payload
+    uint32_t payload_size;  // bytes
+    uint32_t index;        // ring index in the session
+    bool shared;
+} ring_head_t;
+
+// Every ring of every session, and a min-heap on the timestamp of those holding an event
+static ring_head_t heads[TRACE_SESSION_MAX * TRACE_THREAD_MAX];
+static ring_head_t *heap[TRACE_SESSION_MAX * TRACE_THREAD_MAX];
+
+// Payload of the event being dispatched, see tracer_receiver_payload()
+static const trace_event_t *payload_event = NULL;
+static uint32_t payload_size = 0;
+static char payload[TRACE_PAYLOAD_MAX];
+
+// Measures the TSC frequency against CLOCK_MONOTONIC, returns 0 on failure
+static int calibrate_tsc(void)
+{
+    if (!clock_tsc_invariant())
+        return 0;
+
+    uint64_t tsc0 = clock_read_tsc();
+    uint64_t ns0 = clock_read_ns(CLOCK_MONOTONIC);
+
+    struct timespec ts = {0, TSC_CALIBRATION_NS};
+    nanosleep(&ts, NULL);
+
+    uint64_t tsc1 = clock_read_tsc();
+    uint64_t ns1 = clock_read_ns(CLOCK_MONOTONIC);
+
+    if (tsc1 <= tsc0 || ns1 <= ns0)
+        return 0;
+
+    clock_tsc_base = tsc1;
+    clock_ns_base = ns1;
+    clock_tsc_mult = ((ns1 - ns0) << 32) / (tsc1 - tsc0);
+    return 1;
+}
+
+static inline uint64_t timestamp_to_ns(const session_t *session, uint64_t timestamp)
+{
+    if (session->clock_source != TRACE_CLOCK_TSC)
+        return timestamp;
+
+    if (timestamp >= clock_tsc_base)
+        return clock_ns_base + (uint64_t)(((unsigned __int128)(timestamp - clock_tsc_base) * clock_tsc_mult) >> 32);
+    return clock_ns_base - (uint64_t)(((unsigned __int128)(clock_tsc_base - timestamp) * clock_tsc_mult) >> 32);
+}
+
+static trace_shm_header_t *session_buffer(uint32_t session)
+{
+    return session < session_count ? sessions[session].buffer : NULL;
+}
+
+// Creates and sets up the session's segment, returns its index or -1
+static int create_session(const char *name)
+{
+    name = segment_session(name);
+    for (uint32_t i = 0; i < session_count; ++i)
+    {
+        if (strcmp(sessions[i].name, name) == 0)
+            return -1; // already attached
+    }
+    if (session_count == TRACE_SESSION_MAX)
+        return -1;
+
+    session_t *session = &sessions[session_count];
+    memset(session, 0, sizeof(*session));
+    session->fd = -1;
+    if (segment_name(name, session->shm_name, sizeof(session->shm_name)) != 0)
+        return -1;
+    snprintf(session->name, sizeof(session->name), "%s", name);
+
+    session->size = segment_size(ring_capacity, ring_count);
+    session->fd = segment_create(session->shm_name, &session->size, receiver_config.map_flags);
+    if (session->fd == -1)
+        return -1;
+
+    trace_shm_header_t *buffer = mmap(NULL, session->size, PROT_READ | PROT_WRITE, MAP_SHARED, session->fd, 0);
+    if (buffer == MAP_FAILED)
+    {
+        close(session->fd);
+        segment_unlink(session->shm_name);
+        return -1;
+    }
+    session->buffer = buffer;
+    session->map_obtained = segment_prepare(session->fd, buffer, session->size, receiver_config.map_flags);
+    session->ring_capacity = ring_capacity;
+    session->ring_count = ring_count;
+    session->clock_source = clock_source;
+
+    segment_format(buffer, session->size, ring_capacity, ring_count, receiver_config.payload_max);
+    buffer->clock_source = clock_source;
+    buffer->clock_tsc_base = clock_tsc_base;
+    buffer->clock_ns_base = clock_ns_base;
+    buffer->clock_tsc_mult = clock_tsc_mult;
+
+    atomic_store_explicit(&buffer->backpressure, receiver_config.backpressure, memory_order_relaxed);
+    buffer->backpressure_spin_ns = receiver_config.spin_ns;
+    buffer->receiver_pid = (uint32_t)getpid();
+
+    // Emitters refuse to attach until the magic is there
+    __atomic_store_n(&buffer->magic, TRACE_SHM_MAGIC, __ATOMIC_RELEASE);
+    return (int)session_count++;
+}
+
+static void close_session(session_t *session)
+{
+    if (session->buffer)
+    {
+        // Emitters waiting for room would otherwise wait for a receiver that is gone
+        atomic_store_explicit(&session->buffer->receiver_closed, 1, memory_order_seq_cst);
+        for (uint32_t i = 0; i < session->ring_count; ++i)
+            futex_wake_all(&trace_shm_ring(session->buffer, i)->read_index);
+
+        munmap(session->buffer, session->size);
+        session->buffer = NULL;
+    }
+    if (session->fd != -1)
+    {
+        close(session->fd);
+        segment_unlink(session->shm_name);
+        session->fd = -1;
+    }
+}
+
 void tracer_receiver_init(void)
 {
-    shm_fd = shm_open(TRACE_SHM_NAME, O_CREAT | O_RDWR, 0666);
-    if (shm_fd == -1)
-        return;
-    if (ftruncate(shm_fd, sizeof(trace_shared_buffer_t)) == -1)
-        return;
+    tracer_receiver_init_config(NULL);
+}
 
-    shared_buffer = mmap(NULL, sizeof(trace_shared_buffer_t), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (shared_buffer == MAP_FAILED)
-        return;
+void tracer_receiver_init_config(const tracer_receiver_config_t *config)
+{
+    tracer_receiver_config_t defaults = TRACER_RECEIVER_CONFIG_DEFAULT;
+    if (!config)
+        config = &defaults;
+    receiver_config = *config;
+
+    // Calibrate before creating the segment so emitters never see a half-written clock record
+    clock_source = config->clock;
+    wait_strategy = config->wait_strategy;
+    wait_spin_ns = config->wait_spin_ns;
+    wait_cpu = config->cpu;
+    atomic_store(&stop_requested, 0);
+    if (clock_source == TRACE_CLOCK_TSC && !calibrate_tsc())
+        clock_source = TRACE_CLOCK_MONOTONIC;
 
-    atomic_store_explicit(&shared_buffer->read_index, 0, memory_order_release);
-    atomic_store_explicit(&shared_buffer->emit_write_index, 0, memory_order_release);
-    atomic_store_explicit(&shared_buffer->rec_write_index, 0, memory_order_release);
+    // Geometry: ring capacity rounded up to a power of two, at least the shared ring
+    ring_capacity = TRACE_RING_CAPACITY_MIN;
+    while (ring_capacity < config->ring_capacity && ring_capacity < TRACE_RING_CAPACITY_MAX)
+        ring_capacity <<= 1;
+    ring_count = config->ring_count < 1 ? 1 : config->ring_count;
+    if (ring_count > TRACE_THREAD_MAX)
+        ring_count = TRACE_THREAD_MAX;
+
+    session_count = 0;
+    if (create_session(config->session) == -1)
+        return;
 
     receiver_dispatcher = dispatcher_create(/*max_handlers=*/16, /*num_threads=*/4);
 }
 
+int tracer_receiver_add_session(const char *session)
+{
+    if (session_count == 0)
+        return -1; // not initialized
+    return create_session(session);
+}
+
+uint32_t tracer_receiver_session_count(void)
+{
+    return session_count;
+}
+
+// Units claimed by producers: records before it have been (or are being) written. On a
+// per-thread ring the producer only claims on emit_write_index in overwrite mode, ahead
+// of its published write index by at most a reservation.
+static uint32_t ring_claim(const trace_ring_t *ring, uint32_t capacity, bool shared)
+{
+    uint32_t write = atomic_load_explicit(shared ? &ring->emit_write_index : &ring->rec_write_index,
+                                          memory_order_acquire);
+    if (!shared)
+    {
+        uint32_t claim = atomic_load_explicit(&ring->emit_write_index, memory_order_relaxed);
+        if ((int32_t)(claim - write) > 0 && claim - write <= capacity / 2)
+            return claim;
+    }
+    return write;
+}
+
+// A dump is any file handed to the receiver: check every value later used as a size,
+// an index or an offset before trusting it
+static bool dump_valid(const trace_shm_header_t *buffer, size_t size)
+{
+    uint32_t capacity = buffer->ring_capacity;
+    if (buffer->magic != TRACE_SHM_MAGIC || buffer->version != TRACE_SHM_VERSION ||
+        buffer->header_size != sizeof(trace_shm_header_t) || buffer->segment_size != size)
+        return false;
+
+    if (capacity < TRACE_RING_CAPACITY_MIN || capacity > TRACE_RING_CAPACITY_MAX || (capacity & (capacity - 1)) ||
+        buffer->ring_count < 1 || buffer->ring_count > TRACE_THREAD_MAX ||
+        buffer->rings_offset < sizeof(trace_shm_header_t) || buffer->rings_offset > size ||
+        buffer->ring_stride < trace_ring_stride(capacity) ||
+        buffer->ring_stride > (size - buffer->rings_offset) / buffer->ring_count)
+        return false;
+
+    uint32_t payload_max = trace_payload_fits(capacity);
+    if (payload_max > TRACE_PAYLOAD_MAX)
+        payload_max = TRACE_PAYLOAD_MAX;
+    return buffer->payload_max <= payload_max &&
+           atomic_load_explicit(&buffer->callsite_count, memory_order_relaxed) <= TRACE_CALLSITE_MAX &&
+           atomic_load_explicit(&buffer->strtab_used, memory_order_relaxed) <= TRACE_STRTAB_SIZE;
+}
+
+// Terminates the dump's strings and forgets callsites pointing past the string table, so
+// lookups never read past the mapping. The mapping is private, the file is left alone.
+static void dump_terminate(trace_shm_header_t *buffer)
+{
+    uint32_t callsite_count = atomic_load_explicit(&buffer->callsite_count, memory_order_relaxed);
+    uint32_t strtab_used = atomic_load_explicit(&buffer->strtab_used, memory_order_relaxed);
+    buffer->strtab[TRACE_STRTAB_SIZE - 1] = '\0';
+    for (uint32_t i = 0; i < TRACE_CALLSITE_MAX; ++i)
+    {
+        trace_callsite_entry_t *entry = &buffer->callsites[i];
+        entry->arg_types[TRACE_ARGS_MAX] = '\0';
+        if (i >= callsite_count || entry->label >= strtab_used || entry->file >= strtab_used ||
+            entry->function >= strtab_used || entry->format >= strtab_used)
+            atomic_store_explicit(&entry->ready, 0, memory_order_relaxed);
+    }
+    for (uint32_t i = 0; i < TRACE_THREAD_MAX; ++i)
+    {
+        buffer->threads[i].name[TRACE_THREAD_NAME_MAX - 1] = '\0';
+        buffer->threads[i].process_name[TRACE_THREAD_NAME_MAX - 1] = '\0';
+    }
+    for (uint32_t i = 0; i < TRACE_CATEGORY_MAX; ++i)
+        buffer->categories[i].name[TRACE_CATEGORY_NAME_MAX - 1] = '\0';
+}
+
+int tracer_receiver_add_dump(const char *path)
+{
+    if (session_count == 0 || session_count == TRACE_SESSION_MAX)
+        return -1;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    trace_shm_header_t *buffer = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(trace_shm_header_t))
+        buffer = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buffer == MAP_FAILED)
+        return -1;
+
+    size_t size = (size_t)st.st_size;
+    if (!dump_valid(buffer, size))
+    {
+        munmap(buffer, size);
+        return -1;
+    }
+    dump_terminate(buffer);
+
+    session_t *session = &sessions[session_count];
+    memset(session, 0, sizeof(*session));
+    const char *base = strrchr(path, '/');
+    snprintf(session->name, sizeof(session->name), "%s", base ? base + 1 : path);
+    session->buffer = buffer;
+    session->size = size;
+    session->fd = -1;
+    session->dump = true;
+    session->ring_capacity = buffer->ring_capacity;
+    session->ring_count = buffer->ring_count;
+    session->clock_source = TRACE_CLOCK_MONOTONIC; // flight recorders don't calibrate the TSC
+
+    // Overwritten rings hold their last ring_capacity units, start at the oldest record
+    // boundary among them. The units before it are lost, reported with a gap before the
+    // ring's first event.
+    for (uint32_t i = 0; i < session->ring_count; ++i)
+    {
+        trace_ring_t *ring = trace_shm_ring(buffer, i);
+        uint32_t claim = ring_claim(ring, session->ring_capacity, i == TRACE_RING_SHARED);
+        unsigned int read = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+        if (claim - read > session->ring_capacity)
+        {
+            unsigned int start = trace_ring_resync(ring, session->ring_capacity, claim - session->ring_capacity, claim);
+            session->lost[i] = start - read;
+            atomic_store_explicit(&ring->read_index, start, memory_order_relaxed);
+        }
+    }
+    return (int)session_count++;
+}
+
+const char *tracer_receiver_session_name(uint32_t session)
+{
+    return session < session_count ? sessions[session].name : NULL;
+}
+
 void tracer_receiver_shutdown(void)
 {
     dispatcher_destroy(receiver_dispatcher);
     receiver_dispatcher = NULL;
 
-    if (shared_buffer)
+    for (uint32_t i = 0; i < session_count; ++i)
+        close_session(&sessions[i]);
+    session_count = 0;
+    symbols_clear();
+}
+
+// Threads of processes that died without tracer_emit_shutdown() never mark
+// themselves exited, detect them so their registry entries can be reclaimed
+static void check_dead_processes(session_t *session)
+{
+    uint64_t now = clock_read_ns(CLOCK_MONOTONIC);
+    if (now - session->last_process_check_ns < PROCESS_CHECK_NS)
+        return;
+    session->last_process_check_ns = now;
+
+    for (uint32_t i = 1; i < TRACE_THREAD_MAX; ++i)
+    {
+        trace_thread_entry_t *entry = &session->buffer->threads[i];
+        if (atomic_load_explicit(&entry->state, memory_order_acquire) != TRACE_THREAD_ACTIVE)
+            continue;
+        if (kill((pid_t)entry->pid, 0) == -1 && errno == ESRCH)
+        {
+            unsigned int expected = TRACE_THREAD_ACTIVE;
+            atomic_compare_exchange_strong_explicit(&entry->state, &expected, TRACE_THREAD_EXITED,
+                                                    memory_order_acq_rel, memory_order_relaxed);
+        }
+    }
+}
+
+// A producer that claimed shared ring units and died before stamping its record would
+// stall the ring forever, give up on the record once it has been pending too long
+static bool stall_expired(session_t *session, trace_ring_t *ring, uint32_t read_idx)
+{
+    if (receiver_config.stall_timeout_ns == 0 ||
+        atomic_load_explicit(&ring->emit_write_index, memory_order_acquire) == read_idx)
+        return false; // not claimed yet, nothing to wait for
+
+    uint64_t now = clock_read_ns(CLOCK_MONOTONIC);
+    if (session->stall_since_ns == 0 || session->stall_index != read_idx)
+    {
+        session->stall_index = read_idx;
+        session->stall_since_ns = now;
+        return false;
+    }
+    return now - session->stall_since_ns >= receiver_config.stall_timeout_ns;
+}
+
+// Skips the head's ring to `read_index`, counting the units in between as lost
+static void ring_skip(ring_head_t *head, uint32_t read_index)
+{
+    head->session->lost[head->index] += read_index - head->read_index;
+    head->session->synced[head->index] = false;
+    head->read_index = read_index;
+    atomic_store_explicit(&head->ring->read_index, read_index, memory_order_release);
+}
+
+// Decodes the record copied out of the ring into the head, returns false if it is
+// malformed or its timestamp is a delta from a record that was skipped
+static bool ring_decode(ring_head_t *head, const uint64_t *record)
+{
+    session_t *session = head->session;
+    uint64_t header = record[0];
+    uint32_t flags = TRACE_RECORD_FLAGS(header);
+    uint32_t kind = TRACE_RECORD_KIND(header);
+    uint32_t arg_count = TRACE_RECORD_ARG_COUNT(header);
+    if (kind > TRACE_EVENT_COMPLETE || arg_count > TRACE_ARGS_MAX || (kind == TRACE_EVENT_COMPLETE && arg_count))
+        return false;
+
+    uint32_t length = 2 + !!(flags & TRACE_RECORD_TIMESTAMP) + !!(flags & TRACE_RECORD_EXT) +
+                      (kind == TRACE_EVENT_COMPLETE ? 1 : arg_count) + !!(flags & TRACE_RECORD_PAYLOAD);
+    if (length > head->size || (!(flags & TRACE_RECORD_PAYLOAD) && length != head->size))
+        return false;
+
+    trace_event_t *event = &head->event;
+    memset(event, 0, sizeof(*event));
+    uint32_t i = 1;
+    event->callsite_id = (uint32_t)record[i];
+    int32_t delta = (int32_t)(record[i++] >> 32);
+    if (flags & TRACE_RECORD_TIMESTAMP)
+        event->timestamp = record[i++];
+    else if (session->synced[head->index])
+        event->timestamp = session->base[head->index] + (uint64_t)(int64_t)delta;
+    else
+        return false;
+
+    event->weight = 1;
+    event->depth = (uint16_t)TRACE_RECORD_DEPTH(header);
+    event->thread_index = head->shared ? TRACE_THREAD_NONE : (uint16_t)head->index;
+    if (flags & TRACE_RECORD_EXT)
+    {
+        event->weight = (uint32_t)record[i];
+        event->depth = (uint16_t)(record[i] >> 32);
+        event->thread_index = (uint16_t)(record[i++] >> 48);
+        if (event->thread_index >= TRACE_THREAD_MAX)
+            return false;
+    }
+    event->kind = (uint8_t)kind;
+    event->arg_count = (uint8_t)arg_count;
+    if (kind == TRACE_EVENT_COMPLETE)
+        event->duration = record[i++];
+    for (uint32_t a = 0; a < arg_count; ++a)
+        event->args[a].u = record[i++];
+
+    head->payload_size = 0;
+    if (flags & TRACE_RECORD_PAYLOAD)
+    {
+        uint64_t size = record[i++];
+        if (size > session->buffer->payload_max ||
+            i + (size + sizeof(uint64_t) - 1) / sizeof(uint64_t) != head->size)
+            return false;
+        head->payload_index = head->read_index + i;
+        head->payload_size = (uint32_t)size;
+    }
+
+    session->base[head->index] = event->timestamp;
+    session->synced[head->index] = true;
+    return true;
+}
+
+// Loads the ring's next published event into the head, returns false if there is none
+// yet. Records given up on, lapped ones and ones that can't be decoded are skipped.
+static bool ring_peek(ring_head_t *head)
+{
+    trace_ring_t *ring = head->ring;
+    uint32_t capacity = head->session->ring_capacity;
+    uint32_t mask = capacity - 1;
+    for (;;)
+    {
+        uint64_t header = __atomic_load_n(&ring->units[head->read_index & mask], __ATOMIC_ACQUIRE);
+        if (TRACE_RECORD_STAMP(header) != head->read_index + 1)
+        {
+            // In overwrite mode producers may lap the receiver: resume at the oldest record
+            // boundary that can still be there
+            uint32_t claim = ring_claim(ring, capacity, head->shared);
+            if ((int32_t)(claim - head->read_index) > (int32_t)capacity)
+                ring_skip(head, trace_ring_resync(ring, capacity, claim - capacity, claim));
+            else if (head->shared && stall_expired(head->session, ring, head->read_index))
+                ring_skip(head, trace_ring_resync(ring, capacity, head->read_index + 1, claim));
+            else
+                return false;
+            continue;
+        }
+
+        uint64_t record[TRACE_RECORD_HEAD_MAX];
+        head->size = TRACE_RECORD_SIZE(header);
+        if (head->size < 2 || head->size > capacity / 2)
+        {
+            ring_skip(head, trace_ring_resync(ring, capacity, head->read_index + 1, ring_claim(ring, capacity, head->shared)));
+            continue;
+        }
+        record[0] = header;
+        for (uint32_t i = 1; i < head->size && i < TRACE_RECORD_HEAD_MAX; ++i)
+            record[i] = ring->units[(head->read_index + i) & mask];
+
+        // In overwrite mode a producer may have rewritten the record while it was copied:
+        // it claims the units first, and stamps its own header last
+        atomic_thread_fence(memory_order_acquire);
+        uint32_t claim = ring_claim(ring, capacity, head->shared);
+        if ((int32_t)(claim - head->read_index) > (int32_t)capacity ||
+            __atomic_load_n(&ring->units[head->read_index & mask], __ATOMIC_RELAXED) != header)
+        {
+            ring_skip(head, trace_ring_resync(ring, capacity, claim - capacity, claim));
+            continue;
+        }
+
+        if (!ring_decode(head, record))
+        {
+            // Delta from a skipped record, or garbage: the next one in the same block
+            // has a full timestamp
+            ring_skip(head, head->read_index + head->size);
+            continue;
+        }
+
+        trace_event_t *event = &head->event;
+        if (event->kind == TRACE_EVENT_COMPLETE)
+            event->duration = timestamp_to_ns(head->session, event->timestamp + event->duration) -
+                              timestamp_to_ns(head->session, event->timestamp);
+        event->timestamp = timestamp_to_ns(head->session, event->timestamp);
+        event->session = (uint16_t)(head->session - sessions);
+        return true;
+    }
+}
+
+// Copies the payload of the head's event out of the ring for tracer_receiver_payload(),
+// returns false if a producer lapped the receiver and rewrote part of it meanwhile
+static bool load_payload(const ring_head_t *head)
+{
+    uint32_t capacity = head->session->ring_capacity;
+    uint32_t offset = head->payload_index & (capacity - 1);
+
+    // The payload may wrap around the end of the ring
+    size_t first = (size_t)(capacity - offset) * sizeof(uint64_t);
+    if (first > head->payload_size)
+        first = head->payload_size;
+    memcpy(payload, &head->ring->units[offset], first);
+    memcpy(payload + first, head->ring->units, head->payload_size - first);
+
+    atomic_thread_fence(memory_order_acquire);
+    return (int32_t)(ring_claim(head->ring, capacity, head->shared) - head->read_index) <= (int32_t)capacity;
+}
+
+// Tells handlers how many events of the head's ring were lost before its next event. The
+// lost units were overwritten, so their records can't be counted: the gap carries the
+// most events that fit in them, and the units themselves.
+static void dispatch_gap(ring_head_t *head)
+{
+    uint64_t *lost = &head->session->lost[head->index];
+    trace_event_t gap = {0};
+    gap.timestamp = head->event.timestamp;
+    gap.thread_index = head->shared ? TRACE_THREAD_NONE : (uint16_t)head->index;
+    gap.session = head->event.session;
+    gap.callsite_id = TRACE_CALLSITE_NONE;
+    gap.weight = 1;
+    gap.kind = TRACE_EVENT_GAP;
+    gap.args[0].u = (*lost + TRACE_RECORD_MIN - 1) / TRACE_RECORD_MIN;
+    gap.args[1].u = *lost;
+    gap.arg_count = 2;
+    *lost = 0;
+    dispatcher_emit(receiver_dispatcher, &gap);
+}
+
+// Ties go to the ring scanned first, keeping delivery deterministic
+static inline bool head_before(const ring_head_t *a, const ring_head_t *b)
+{
+    return a->event.timestamp != b->event.timestamp ? a->event.timestamp < b->event.timestamp : a < b;
+}
+
+static void heap_sift_down(uint32_t size)
+{
+    uint32_t i = 0;
+    ring_head_t *head = heap[0];
+    for (;;)
+    {
+        uint32_t child = 2 * i + 1;
+        if (child >= size)
+            break;
+        if (child + 1 < size && head_before(heap[child + 1], heap[child]))
+            child++;
+        if (!head_before(heap[child], head))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = head;
+}
+
+static void heap_push(ring_head_t *head, uint32_t size)
+{
+    uint32_t i = size;
+    while (i > 0 && head_before(head, heap[(i - 1) / 2]))
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = head;
+}
+
+static void reclaim_threads(session_t *session, const uint8_t *state)
+{
+    for (uint32_t i = 1; i < TRACE_THREAD_MAX; ++i)
+    {
+        if (state[i] != TRACE_THREAD_EXITED)
+            continue;
+
+        if (i < session->ring_count)
+        {
+            // A producer that died mid-batch may have stamped records past its published
+            // write index, the next owner continues right after what was consumed
+            trace_ring_t *ring = trace_shm_ring(session->buffer, i);
+            unsigned int read = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+            session->lost[i] = 0; // not the next owner's loss
+            session->synced[i] = false;
+            atomic_store_explicit(&ring->rec_write_index, read, memory_order_relaxed);
+            atomic_store_explicit(&ring->emit_write_index, read, memory_order_relaxed);
+        }
+        trace_thread_entry_t *entry = &session->buffer->threads[i];
+        session->retired_stats.emitted += atomic_load_explicit(&entry->emitted, memory_order_relaxed);
+        session->retired_stats.dropped += atomic_load_explicit(&entry->dropped, memory_order_relaxed);
+        session->retired_stats.overwritten += atomic_load_explicit(&entry->overwritten, memory_order_relaxed);
+        session->retired_stats.filtered += atomic_load_explicit(&entry->filtered, memory_order_relaxed);
+        session->retired_stats.index_writes += atomic_load_explicit(&entry->index_writes, memory_order_relaxed);
+        atomic_store_explicit(&entry->state, TRACE_THREAD_FREE, memory_order_release);
+    }
+}
+
+// One pass over every ring of every session, returns the number of events consumed.
+// Events are delivered oldest first across all rings (a k-way merge of the ring heads),
+// events published while the pass runs may be older than the last one delivered.
+static unsigned int receive(void)
+{
+    if (session_count == 0 || !receiver_dispatcher)
+        return 0;
+
+    // Threads that exited before the drain below can be reclaimed after it, all of
+    // their events were published before they were marked exited
+    static uint8_t state[TRACE_SESSION_MAX][TRACE_THREAD_MAX];
+    uint32_t head_count = 0, heap_size = 0;
+    for (uint32_t s = 0; s < session_count; ++s)
+    {
+        session_t *session = &sessions[s];
+        if (!session->dump)
+            check_dead_processes(session);
+        for (uint32_t i = 1; i < TRACE_THREAD_MAX; ++i)
+            state[s][i] = (uint8_t)atomic_load_explicit(&session->buffer->threads[i].state, memory_order_acquire);
+
+        for (uint32_t i = 0; i < session->ring_count; ++i)
+        {
+            if (i != TRACE_RING_SHARED && state[s][i] != TRACE_THREAD_ACTIVE && state[s][i] != TRACE_THREAD_EXITED)
+                continue;
+
+            ring_head_t *head = &heads[head_count++];
+            head->session = session;
+            head->ring = trace_shm_ring(session->buffer, i);
+            head->read_index = atomic_load_explicit(&head->ring->read_index, memory_order_acquire);
+            head->index = i;
+            head->shared = i == TRACE_RING_SHARED;
+            if (ring_peek(head))
+                heap_push(head, heap_size++);
+        }
+    }
+
+    unsigned int count = 0;
+    while (heap_size)
     {
-        munmap(shared_buffer, sizeof(trace_shared_buffer_t));
-        shared_buffer = NULL;
+        ring_head_t *head = heap[0];
+        if (head->session->lost[head->index])
+            dispatch_gap(head);
+        if (head->payload_size)
+        {
+            payload_event = &head->event;
+            payload_size = load_payload(head) ? head->payload_size : 0;
+        }
+        dispatcher_emit(receiver_dispatcher, &head->event);
+        payload_event = NULL;
+
+        head->read_index += head->size;
+        atomic_store_explicit(&head->ring->read_index, head->read_index, memory_order_release);
+        count++;
+
+        if (!ring_peek(head))
+            heap[0] = heap[--heap_size];
+        if (heap_size)
+            heap_sift_down(heap_size);
     }
-    if (shm_fd != -1)
+
+    // Pairs with the increment in the emitter before it sleeps on read_index: either
+    // it sees the new read index or we see it waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    for (uint32_t i = 0; i < head_count; ++i)
+    {
+        if (atomic_load_explicit(&heads[i].ring->waiters, memory_order_relaxed))
+            futex_wake_all(&heads[i].ring->read_index);
+    }
+
+    // A dump's registry is left as it was written, no emitter will reuse its entries
+    for (uint32_t s = 0; s < session_count; ++s)
     {
-        close(shm_fd);
-        shm_unlink(TRACE_SHM_NAME);
-        shm_fd = -1;
+        if (!sessions[s].dump)
+            reclaim_threads(&sessions[s], state[s]);
     }
+    return count;
 }
 
 void tracer_receiver_poll(void)
 {
-    if (!shared_buffer || !receiver_dispatcher)
+    receive();
+}
+
+static void pin_thread(void)
+{
+    static _Thread_local bool pinned = false;
+    if (pinned || wait_cpu < 0)
         return;
 
-    uint32_t read_idx = atomic_load_explicit(&shared_buffer->read_index, memory_order_acquire);
-    uint32_t write_idx = atomic_load_explicit(&shared_buffer->rec_write_index, memory_order_acquire);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(wait_cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    pinned = true;
+}
+
+unsigned int tracer_receiver_wait(uint64_t timeout_ns)
+{
+    if (session_count == 0)
+        return 0;
+
+    pin_thread();
+
+    // With several sessions the receiver sleeps on all their doorbells at once. Kernels
+    // without futex_waitv only let it sleep on the first one's, it then wakes up
+    // regularly to look at the others.
+    static int wait_any_missing;
+    uint64_t slice_ns = session_count > 1 && wait_any_missing ? SESSIONS_WAIT_SLICE_NS : WAIT_SLICE_NS;
+
+    uint64_t start = clock_read_ns(CLOCK_MONOTONIC);
+    for (;;)
+    {
+        unsigned int count = receive();
+        if (count || atomic_load_explicit(&stop_requested, memory_order_relaxed))
+            return count;
+
+        uint64_t elapsed = clock_read_ns(CLOCK_MONOTONIC) - start;
+        if (elapsed >= timeout_ns)
+            return 0;
+
+        if (wait_strategy == TRACE_WAIT_SPIN || elapsed < wait_spin_ns)
+        {
+            cpu_relax();
+            continue;
+        }
+        if (wait_strategy == TRACE_WAIT_SPIN_YIELD)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // Adaptive: still idle after spinning, sleep until an emitter publishes. Emitters
+        // that see the epoch change check the flag after publishing (seq_cst on both
+        // sides), so either they see it and ring the doorbell, or the poll below sees
+        // their events. One racing with the epoch bump is seen after a wait slice.
+        atomic_uint *doorbells[TRACE_SESSION_MAX];
+        unsigned int rung[TRACE_SESSION_MAX];
+        for (uint32_t i = 0; i < session_count; ++i)
+        {
+            trace_shm_header_t *buffer = sessions[i].buffer;
+            doorbells[i] = &buffer->receiver_doorbell;
+            rung[i] = atomic_load_explicit(&buffer->receiver_doorbell, memory_order_acquire);
+            atomic_store_explicit(&buffer->receiver_sleeping, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&buffer->receiver_epoch, 1, memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_seq_cst);
+        count = receive();
+        if (count == 0 && !atomic_load_explicit(&stop_requested, memory_order_relaxed))
+        {
+            uint64_t remaining = timeout_ns - elapsed;
+            uint64_t sleep_ns = remaining < slice_ns ? remaining : slice_ns;
+            if (session_count == 1 || wait_any_missing)
+                futex_wait(doorbells[0], rung[0], sleep_ns);
+            else if (futex_wait_any(doorbells, rung, session_count, sleep_ns) == -1)
+            {
+                wait_any_missing = 1;
+                slice_ns = SESSIONS_WAIT_SLICE_NS;
+            }
+        }
+        for (uint32_t i = 0; i < session_count; ++i)
+            atomic_store_explicit(&sessions[i].buffer->receiver_sleeping, 0, memory_order_relaxed);
+        if (count)
+            return count;
+    }
+}
+
+void tracer_receiver_run(void)
+{
+    while (!atomic_load_explicit(&stop_requested, memory_order_relaxed))
+        tracer_receiver_wait(TRACER_WAIT_FOREVER);
+    atomic_store(&stop_requested, 0);
+}
+
+void tracer_receiver_stop(void)
+{
+    atomic_store(&stop_requested, 1);
+    for (uint32_t i = 0; i < session_count; ++i)
+    {
+        atomic_fetch_add_explicit(&sessions[i].buffer->receiver_doorbell, 1, memory_order_release);
+        futex_wake_all(&sessions[i].buffer->receiver_doorbell);
+    }
+}
+
+trace_clock_source_t tracer_receiver_clock(void)
+{
+    return clock_source;
+}
+
+unsigned int tracer_receiver_mapping(void)
+{
+    return session_count ? sessions[0].map_obtained : 0;
+}
+
+void tracer_receiver_set_backpressure(trace_backpressure_t backpressure)
+{
+    for (uint32_t i = 0; i < session_count; ++i)
+        atomic_store_explicit(&sessions[i].buffer->backpressure, backpressure, memory_order_relaxed);
+}
+
+void tracer_receiver_set_enabled(int enabled)
+{
+    for (uint32_t i = 0; i < session_count; ++i)
+    {
+        trace_shm_header_t *buffer = sessions[i].buffer;
+        if (enabled)
+            atomic_fetch_or_explicit(&buffer->enable_mask, TRACE_MASK_ENABLED, memory_order_relaxed);
+        else
+            atomic_fetch_and_explicit(&buffer->enable_mask, ~TRACE_MASK_ENABLED, memory_order_relaxed);
+    }
+}
+
+void tracer_receiver_enable_category(const char *category, int enabled)
+{
+    for (uint32_t i = 0; i < session_count; ++i)
+    {
+        // Adds the category if no emitter has used it yet, so it can be enabled in advance
+        trace_shm_header_t *buffer = sessions[i].buffer;
+        uint64_t bits = category_bits(buffer, category);
+        if (enabled)
+            atomic_fetch_or_explicit(&buffer->enable_mask, bits, memory_order_relaxed);
+        else
+            atomic_fetch_and_explicit(&buffer->enable_mask, ~bits, memory_order_relaxed);
+    }
+}
+
+void tracer_receiver_enable_all_categories(int enabled)
+{
+    for (uint32_t i = 0; i < session_count; ++i)
+    {
+        trace_shm_header_t *buffer = sessions[i].buffer;
+        if (enabled)
+            atomic_fetch_or_explicit(&buffer->enable_mask, ~TRACE_MASK_ENABLED, memory_order_relaxed);
+        else
+            atomic_fetch_and_explicit(&buffer->enable_mask, TRACE_MASK_ENABLED, memory_order_relaxed);
+    }
+}
+
+int tracer_receiver_session_thread(uint32_t session, uint32_t thread_index, trace_thread_t *thread)
+{
+    trace_shm_header_t *buffer = session_buffer(session);
+    if (!buffer || thread_index == TRACE_THREAD_NONE || thread_index >= TRACE_THREAD_MAX)
+        return -1;
+
+    const trace_thread_entry_t *entry = &buffer->threads[thread_index];
+    unsigned int state = atomic_load_explicit(&entry->state, memory_order_acquire);
+    if (state != TRACE_THREAD_ACTIVE && state != TRACE_THREAD_EXITED)
+        return -1;
+
+    thread->tid = entry->tid;
+    thread->pid = entry->pid;
+    thread->start_timestamp = timestamp_to_ns(&sessions[session], entry->start_timestamp);
+    thread->name = entry->name;
+    thread->process_name = entry->process_name;
+    thread->stats.emitted = atomic_load_explicit(&entry->emitted, memory_order_relaxed);
+    thread->stats.dropped = atomic_load_explicit(&entry->dropped, memory_order_relaxed);
+    thread->stats.overwritten = atomic_load_explicit(&entry->overwritten, memory_order_relaxed);
+    thread->stats.filtered = atomic_load_explicit(&entry->filtered, memory_order_relaxed);
+    thread->stats.index_writes = atomic_load_explicit(&entry->index_writes, memory_order_relaxed);
+    return 0;
+}
+
+int tracer_receiver_thread(uint32_t thread_index, trace_thread_t *thread)
+{
+    return tracer_receiver_session_thread(0, thread_index, thread);
+}
+
+int tracer_receiver_event_thread(const trace_event_t *event, trace_thread_t *thread)
+{
+    return tracer_receiver_session_thread(event->session, event->thread_index, thread);
+}
+
+void tracer_receiver_stats(trace_thread_stats_t *stats)
+{
+    *stats = (trace_thread_stats_t){0};
+    for (uint32_t s = 0; s < session_count; ++s)
+    {
+        stats->emitted += sessions[s].retired_stats.emitted;
+        stats->dropped += sessions[s].retired_stats.dropped;
+        stats->overwritten += sessions[s].retired_stats.overwritten;
+        stats->filtered += sessions[s].retired_stats.filtered;
+        stats->index_writes += sessions[s].retired_stats.index_writes;
+
+        for (uint32_t i = 1; i < TRACE_THREAD_MAX; ++i)
+        {
+            const trace_thread_entry_t *entry = &sessions[s].buffer->threads[i];
+            unsigned int state = atomic_load_explicit(&entry->state, memory_order_acquire);
+            if (state != TRACE_THREAD_ACTIVE && state != TRACE_THREAD_EXITED)
+                continue;
 
-    while (read_idx != write_idx)
+            stats->emitted += atomic_load_explicit(&entry->emitted, memory_order_relaxed);
+            stats->dropped += atomic_load_explicit(&entry->dropped, memory_order_relaxed);
+            stats->overwritten += atomic_load_explicit(&entry->overwritten, memory_order_relaxed);
+            stats->filtered += atomic_load_explicit(&entry->filtered, memory_order_relaxed);
+            stats->index_writes += atomic_load_explicit(&entry->index_writes, memory_order_relaxed);
+        }
+    }
+}
+
+static int session_callsite(uint32_t session, uint32_t callsite_id, trace_callsite_t *callsite)
+{
+    trace_shm_header_t *buffer = session_buffer(session);
+    if (!buffer || callsite_id == TRACE_CALLSITE_NONE || callsite_id >= TRACE_CALLSITE_MAX)
+        return -1;
+
+    const trace_callsite_entry_t *entry = &buffer->callsites[callsite_id];
+    if (!atomic_load_explicit(&entry->ready, memory_order_acquire))
+        return -1;
+
+    callsite->label = &buffer->strtab[entry->label];
+    callsite->file = &buffer->strtab[entry->file];
+    callsite->function = &buffer->strtab[entry->function];
+    callsite->line = entry->line;
+    callsite->format = entry->format ? &buffer->strtab[entry->format] : NULL;
+    callsite->arg_types = entry->arg_types[0] ? entry->arg_types : NULL;
+    callsite->value_kind = entry->value_kind;
+    callsite->id = callsite_id;
+    callsite->next = NULL;
+    return 0;
+}
+
+int tracer_receiver_callsite(uint32_t callsite_id, trace_callsite_t *callsite)
+{
+    return session_callsite(0, callsite_id, callsite);
+}
+
+const void *tracer_receiver_payload(const trace_event_t *event, uint32_t *size)
+{
+    if (event != payload_event || payload_size == 0)
     {
-        uint32_t idx = read_idx & (TRACE_BUFFER_SIZE - 1);
-        dispatcher_emit(receiver_dispatcher, &shared_buffer->events[idx]);
-        atomic_store_explicit(&shared_buffer->read_index, ++read_idx, memory_order_release);
-        write_idx = atomic_load_explicit(&shared_buffer->rec_write_index, memory_order_acquire);
+        *size = 0;
+        return NULL;
     }
+    *size = payload_size;
+    return payload;
+}
+
+int tracer_receiver_event_callsite(const trace_event_t *event, trace_callsite_t *callsite)
+{
+    return session_callsite(event->session, event->callsite_id, callsite);
+}
+
+int tracer_receiver_format(const trace_event_t *event, char *buf, size_t size)
+{
+    trace_callsite_t callsite;
+    if (tracer_receiver_event_callsite(event, &callsite) != 0 || !callsite.format)
+        return -1;
+
+    uint32_t arg_count = event->arg_count;
+    if (arg_count > strlen(callsite.arg_types))
+        arg_count = (uint32_t)strlen(callsite.arg_types);
+    return format_args(buf, size, callsite.format, callsite.arg_types, event->args, arg_count);
+}
+
+const char *tracer_receiver_label(uint32_t callsite_id)
+{
+    trace_callsite_t callsite;
+    if (tracer_receiver_callsite(callsite_id, &callsite) != 0)
+        return "?";
+    return callsite.label;
+}
+
+const char *tracer_receiver_event_label(const trace_event_t *event)
+{
+    trace_callsite_t callsite;
+    if (tracer_receiver_event_callsite(event, &callsite) != 0)
+        return "?";
+    return callsite.label;
+}
+
+const char *tracer_receiver_symbol(const trace_event_t *event)
+{
+    trace_callsite_t callsite;
+    if (tracer_receiver_event_callsite(event, &callsite) != 0 || callsite.value_kind != TRACE_VALUE_FUNCTION ||
+        event->arg_count == 0)
+        return NULL;
+    return symbols_lookup(callsite.label, event->args[0].u);
 }
 
 void tracer_receiver_register_handler_ex(trace_event_handler_ex_t fn, void *ctx)
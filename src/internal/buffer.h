@@ -2,20 +2,269 @@
 #define TRACER_BUFFER_H
 
 #include <stdatomic.h>
+#include <stddef.h>
 
 #include "tracering/event.h"
+#include "tracering/backpressure.h"
+#include "tracering/clock.h"
 
-#define TRACE_SHM_NAME "/tracering_shm"
+#define TRACE_SHM_NAME "/tracering_shm" // default session, see segment_name()
 
-#define TRACE_BUFFER_BITS 12
-#define TRACE_BUFFER_SIZE (1 << TRACE_BUFFER_BITS)
+#define TRACE_CACHE_LINE 64
 
+#define TRACE_SHM_MAGIC 0x474e495245434154ull // "TACERING", written last once the segment is ready
+#define TRACE_SHM_VERSION 18                   // bump on any change to the segment layout or to what
+                                               // it holds (event kinds, value kinds...)
+
+// Ring directory: ring 0 is the shared multi-producer ring, ring i (0 < i < ring_count)
+// is the single-producer ring of the thread with registry index i. Threads with a
+// higher index (or none) fall back to the shared ring.
+#define TRACE_RING_SHARED 0
+
+#define TRACE_RING_CAPACITY_MIN 256 // units, at least one directory block per ring
+#define TRACE_RING_CAPACITY_MAX (1u << 28)
+
+#define TRACE_THREAD_MAX 256
+#define TRACE_THREAD_NAME_MAX 16 // pthread names are limited to 16 bytes including the terminator
+#define TRACE_THREAD_STATS_INTERVAL 1024 // events between two publications of a thread's counters
+
+// Category bits of the enable mask: bit 0 is uncategorized events, named categories
+// take bits 1 to 62 in registration order, bit 63 is the global switch
+#define TRACE_CATEGORY_MAX 62
+#define TRACE_CATEGORY_NAME_MAX 32
+
+#define TRACE_CALLSITE_MAX 4096
+#define TRACE_INTERN_SLOTS (2 * TRACE_CALLSITE_MAX) // hash table of interned labels, power of two
+#define TRACE_STRTAB_SIZE (128 * 1024)
+
+// Callsite registry entry, strings are offsets into the shared string table.
+// Offset 0 always holds the "?" placeholder used when the table is full.
+typedef struct
+{
+    atomic_uint ready; // set (release) once the entry is fully written
+    uint32_t label;
+    uint32_t file;
+    uint32_t function;
+    uint32_t line;
+    uint32_t format; // 0 unless the callsite is a TRACE_ARGS one
+    char arg_types[TRACE_ARGS_MAX + 1];
+    uint32_t value_kind; // trace_value_kind_t
+} trace_callsite_entry_t;
+
+// Category table entry, names are claimed by the first emitter (or receiver) to use
+// them, the entry's index + 1 is the category's bit in the enable mask
+enum
+{
+    TRACE_CATEGORY_FREE = 0,
+    TRACE_CATEGORY_CLAIMED,
+    TRACE_CATEGORY_READY,
+};
+
+typedef struct
+{
+    atomic_uint state;
+    char name[TRACE_CATEGORY_NAME_MAX];
+} trace_category_entry_t;
+
+// Thread registry entry lifecycle: an emitting thread claims a FREE entry, fills
+// it in and publishes it as ACTIVE. On thread exit (or emitter shutdown, or when
+// the receiver finds the process gone) it becomes EXITED, and the receiver returns
+// it to FREE once every event published before that has been consumed.
+enum
+{
+    TRACE_THREAD_FREE = 0,
+    TRACE_THREAD_CLAIMED,
+    TRACE_THREAD_ACTIVE,
+    TRACE_THREAD_EXITED,
+};
+
+typedef struct
+{
+    atomic_uint state;
+    uint32_t tid;
+    uint32_t pid;
+    uint64_t start_timestamp; // emitter clock, same units as event timestamps
+    char name[TRACE_THREAD_NAME_MAX];
+    char process_name[TRACE_THREAD_NAME_MAX];
+
+    // Counted in the emitter's TLS and copied here every TRACE_THREAD_STATS_INTERVAL
+    // events, on every drop and when the thread exits
+    atomic_ullong emitted;
+    atomic_ullong dropped;
+    atomic_ullong overwritten;
+    atomic_ullong filtered;
+    atomic_ullong index_writes;
+} trace_thread_entry_t;
+
+// Rings hold variable-size records in 8-byte units. A record starts with a header word:
+//
+//   bits  0-31  stamp, the record's absolute unit index + 1, so a header left by an
+//               earlier lap never matches
+//   bits 32-47  size in units, header included
+//   bits 48-50  kind (trace_event_kind_t)
+//   bits 51-53  arg_count
+//   bits 54-56  TRACE_RECORD_* flags
+//   bits 57-63  depth, TRACE_RECORD_DEPTH_EXT if it doesn't fit
+//
+// followed by the body, in this order:
+//
+//   callsite id | timestamp delta    (low | high 32 bits), the delta (signed) is from the
+//                                    previous record of the same producer in the ring
+//   timestamp                        TRACE_RECORD_TIMESTAMP: replaces the delta
+//   weight | depth | thread index    TRACE_RECORD_EXT (32 | 16 | 16 bits)
+//   args[arg_count] or duration      TRACE_EVENT_COMPLETE records carry a duration
+//   payload size, payload            TRACE_RECORD_PAYLOAD: size in bytes, then the data
+//
+// A bare event from a thread's own ring takes 2 units. The producer writes the body,
+// then the header with a release store, which publishes the record: the receiver
+// consumes records in order while the stamp matches.
+//
+// Records on the shared ring always carry the timestamp and the thread index. On a
+// per-thread ring they carry the timestamp only when needed: for the first record of
+// the producer, when the delta doesn't fit, and for the first record starting in each
+// block of TRACE_RING_BLOCK units. Each ring has a directory with the start of the first
+// record at or after each block start, written by the producer of the record covering
+// it: a receiver lapped in overwrite mode (or skipping a record that is never
+// published) finds the next record boundary there, with a full timestamp.
+//
+// In overwrite mode producers claim their units on emit_write_index before writing
+// them. The receiver checks it after copying a record: if units past read_index +
+// ring_capacity were claimed meanwhile, the copy may be torn.
+#define TRACE_RECORD_TIMESTAMP (1u << 0)
+#define TRACE_RECORD_EXT (1u << 1)
+#define TRACE_RECORD_PAYLOAD (1u << 2)
+#define TRACE_RECORD_DEPTH_EXT 127 // depth in the ext word
+#define TRACE_RECORD_MIN 2         // units of the smallest record, a bare event
+
+// Records store the optional part of trace_event_t only when present
+_Static_assert(offsetof(trace_event_t, args) == 24, "trace_event_t base grew, update the record format");
+
+#define TRACE_RECORD_HEAD_MAX 9 // units before the payload: header, callsite, timestamp, ext, 4 args, size
+#define TRACE_RING_BLOCK 64     // units per directory entry
+
+static inline uint64_t trace_record_header(uint32_t pos, uint32_t size, uint32_t kind, uint32_t arg_count,
+                                           uint32_t flags, uint32_t depth)
+{
+    return (uint64_t)(pos + 1) | (uint64_t)size << 32 | (uint64_t)kind << 48 | (uint64_t)arg_count << 51 |
+           (uint64_t)flags << 54 | (uint64_t)depth << 57;
+}
+
+#define TRACE_RECORD_STAMP(header) ((uint32_t)(header))
+#define TRACE_RECORD_SIZE(header) ((uint32_t)((header) >> 32) & 0xFFFF)
+#define TRACE_RECORD_KIND(header) ((uint32_t)((header) >> 48) & 0x7)
+#define TRACE_RECORD_ARG_COUNT(header) ((uint32_t)((header) >> 51) & 0x7)
+#define TRACE_RECORD_FLAGS(header) ((uint32_t)((header) >> 54) & 0x7)
+#define TRACE_RECORD_DEPTH(header) ((uint32_t)((header) >> 57))
+
+// Units before read_index have been consumed. On per-thread rings the owning thread
+// is the only writer and publishes rec_write_index after writing its records, on the
+// shared ring producers claim units on emit_write_index first. The number of units
+// (ring_capacity, a power of two) is chosen by the receiver, the block directory
+// follows the units.
+typedef struct
+{
+    _Alignas(TRACE_CACHE_LINE) atomic_uint read_index; // written by the receiver
+    atomic_uint waiters; // emitters sleeping on read_index, TRACE_BACKPRESSURE_BLOCK
+    _Alignas(TRACE_CACHE_LINE) atomic_uint emit_write_index; // shared ring, and per-thread rings in overwrite mode
+    _Alignas(TRACE_CACHE_LINE) atomic_uint rec_write_index;
+    _Alignas(TRACE_CACHE_LINE) uint64_t units[]; // headers are accessed with __atomic builtins
+} trace_ring_t;
+
+// Start of the shared segment. The rings follow the header at rings_offset,
+// ring i starts at rings_offset + i * ring_stride.
 typedef struct
 {
-    atomic_uint read_index;
-    atomic_uint emit_write_index;
-    atomic_uint rec_write_index;
-    trace_event_t events[TRACE_BUFFER_SIZE];
-} trace_shared_buffer_t;
+    uint64_t magic; // TRACE_SHM_MAGIC once the receiver has finished setting up
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t segment_size;
+
+    uint32_t ring_capacity; // units per ring, power of two
+    uint32_t ring_count;    // including the shared ring
+    uint64_t rings_offset;
+    uint64_t ring_stride;
+    uint32_t payload_max; // bytes, longer payloads are truncated by the emitter
+
+    // Clock selected by the receiver. For TRACE_CLOCK_TSC events carry raw ticks and
+    // the receiver converts them: ns = clock_ns_base + ((ticks - clock_tsc_base) * clock_tsc_mult) >> 32
+    uint32_t clock_source; // trace_clock_source_t
+    uint64_t clock_tsc_base;
+    uint64_t clock_ns_base;
+    uint64_t clock_tsc_mult; // ns per tick, 32.32 fixed point
+    _Alignas(TRACE_CACHE_LINE) atomic_ullong clock_manual_ns;
+
+    // Full-ring policy, emitters reload it every TRACE_THREAD_STATS_INTERVAL events
+    _Alignas(TRACE_CACHE_LINE) atomic_uint backpressure; // trace_backpressure_t
+    uint64_t backpressure_spin_ns;
+
+    // Waiting emitters give up once the receiver has shut down or died
+    uint32_t receiver_pid;
+    atomic_uint receiver_closed;
+
+    // Set by a receiver about to sleep in tracer_receiver_wait() after finding every ring
+    // empty. The first emitter to publish after that clears it, bumps the doorbell and
+    // wakes the receiver with FUTEX_WAKE on it. The epoch counts the receiver's sleeps,
+    // emitters only look at the flag once it has changed or their ring was empty.
+    _Alignas(TRACE_CACHE_LINE) atomic_uint receiver_sleeping;
+    atomic_uint receiver_doorbell;
+    atomic_uint receiver_epoch;
+
+    // Emitters check it with one relaxed load before doing any work, see tracer_enabled()
+    _Alignas(TRACE_CACHE_LINE) atomic_ullong enable_mask;
+    trace_category_entry_t categories[TRACE_CATEGORY_MAX];
+
+    trace_thread_entry_t threads[TRACE_THREAD_MAX]; // entry 0 is reserved for TRACE_THREAD_NONE
+
+    atomic_uint callsite_count; // entry 0 is reserved for TRACE_CALLSITE_NONE
+    atomic_uint strtab_used;
+    trace_callsite_entry_t callsites[TRACE_CALLSITE_MAX];
+
+    // Labels interned at runtime, open addressing on the label's hash: hash << 32 | callsite
+    // id, 0 for a free entry. Entries are set once with a CAS and never removed.
+    atomic_ullong interned[TRACE_INTERN_SLOTS];
+    char strtab[TRACE_STRTAB_SIZE];
+} trace_shm_header_t;
+
+static inline size_t trace_ring_stride(uint32_t ring_capacity)
+{
+    size_t size = offsetof(trace_ring_t, units) + (size_t)ring_capacity * sizeof(uint64_t) +
+                  ring_capacity / TRACE_RING_BLOCK * sizeof(atomic_uint);
+    return (size + TRACE_CACHE_LINE - 1) & ~(size_t)(TRACE_CACHE_LINE - 1);
+}
+
+static inline trace_ring_t *trace_shm_ring(trace_shm_header_t *header, uint32_t ring)
+{
+    return (trace_ring_t *)((char *)header + header->rings_offset + ring * header->ring_stride);
+}
+
+// Block directory: entry i holds the first record start at or after block start i
+// (modulo the number of blocks)
+static inline atomic_uint *trace_ring_blocks(trace_ring_t *ring, uint32_t ring_capacity)
+{
+    return (atomic_uint *)&ring->units[ring_capacity];
+}
+
+// First record boundary at or after `from` and no later than `claim` found in the
+// ring's block directory, `claim` if there is none
+static inline uint32_t trace_ring_resync(trace_ring_t *ring, uint32_t capacity, uint32_t from, uint32_t claim)
+{
+    const atomic_uint *blocks = trace_ring_blocks(ring, capacity);
+    uint32_t mask = capacity / TRACE_RING_BLOCK - 1;
+    for (uint32_t block = (from + TRACE_RING_BLOCK - 1) & ~(TRACE_RING_BLOCK - 1u);
+         (int32_t)(claim - block) > 0; block += TRACE_RING_BLOCK)
+    {
+        // Entries left by an earlier lap point before their block
+        uint32_t start = atomic_load_explicit(&blocks[(block / TRACE_RING_BLOCK) & mask], memory_order_relaxed);
+        if ((int32_t)(start - block) >= 0 && start - block <= capacity / 2 && (int32_t)(claim - start) >= 0)
+            return start;
+    }
+    return claim;
+}
+
+// Largest payload a ring of this capacity takes: a record is at most half a ring
+static inline uint32_t trace_payload_fits(uint32_t ring_capacity)
+{
+    return (ring_capacity / 2 - TRACE_RECORD_HEAD_MAX) * (uint32_t)sizeof(uint64_t);
+}
 
-#endif // TRACER_BUFFER_H
\ No newline at end of file
+#endif // TRACER_BUFFER_H
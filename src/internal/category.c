@@ -0,0 +1,51 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "category.h"
+
+#include <string.h>
+
+#include "clock.h"
+
+#define CLAIMED_SPIN_MAX 1000000 // an entry claimed this long ago belongs to a dead process
+
+static int wait_ready(trace_category_entry_t *entry, unsigned int state)
+{
+    for (int i = 0; state == TRACE_CATEGORY_CLAIMED && i < CLAIMED_SPIN_MAX; ++i)
+    {
+        cpu_relax();
+        state = atomic_load_explicit(&entry->state, memory_order_acquire);
+    }
+    return state == TRACE_CATEGORY_READY;
+}
+
+uint64_t category_bits(trace_shm_header_t *header, const char *name)
+{
+    if (!name)
+        return TRACE_MASK_UNCATEGORIZED;
+
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < TRACE_CATEGORY_MAX; ++i)
+    {
+        trace_category_entry_t *entry = &header->categories[i];
+        unsigned int state = atomic_load_explicit(&entry->state, memory_order_acquire);
+
+        if (state == TRACE_CATEGORY_FREE)
+        {
+            if (bits)
+                break; // entries are claimed in order, there is no other match past here
+
+            if (atomic_compare_exchange_strong_explicit(&entry->state, &state, TRACE_CATEGORY_CLAIMED,
+                                                        memory_order_acquire, memory_order_acquire))
+            {
+                strncpy(entry->name, name, TRACE_CATEGORY_NAME_MAX - 1);
+                atomic_store_explicit(&entry->state, TRACE_CATEGORY_READY, memory_order_release);
+                return 2ull << i;
+            }
+        }
+
+        if (wait_ready(entry, state) && strncmp(entry->name, name, TRACE_CATEGORY_NAME_MAX - 1) == 0)
+            bits |= 2ull << i;
+    }
+
+    return bits ? bits : TRACE_MASK_UNCATEGORIZED;
+}
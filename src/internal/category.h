@@ -0,0 +1,14 @@
+#ifndef TRACER_CATEGORY_H
+#define TRACER_CATEGORY_H
+
+#include <stdint.h>
+
+#include "buffer.h"
+
+// Enable mask bits of the category `name` (NULL for uncategorized events), adding it to
+// the table if no one has yet. Two processes adding the same name at the same time can
+// end up with an entry each, so this returns the bits of every entry with that name.
+// Falls back to the uncategorized bit if the table is full.
+uint64_t category_bits(trace_shm_header_t *header, const char *name);
+
+#endif // TRACER_CATEGORY_H
@@ -0,0 +1,53 @@
+#ifndef TRACER_INTERNAL_CLOCK_H
+#define TRACER_INTERNAL_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define TRACER_HAVE_TSC 1
+#else
+#define TRACER_HAVE_TSC 0
+#endif
+
+static inline uint64_t clock_read_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t clock_read_tsc(void)
+{
+#if TRACER_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Spin-wait hint, lets the sibling hyperthread run while we poll
+static inline void cpu_relax(void)
+{
+#if TRACER_HAVE_TSC
+    _mm_pause();
+#endif
+}
+
+// The TSC is only usable as a clock if it ticks at a constant rate across
+// frequency changes and sleep states (CPUID 0x80000007, EDX bit 8)
+static inline int clock_tsc_invariant(void)
+{
+#if TRACER_HAVE_TSC
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (edx >> 8) & 1;
+#else
+    return 0;
+#endif
+}
+
+#endif // TRACER_INTERNAL_CLOCK_H
@@ -0,0 +1,160 @@
+#include "format.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t len; // full length, may exceed size
+} output_t;
+
+static void append(output_t *out, const char *spec, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(output_t *out, const char *spec, ...)
+{
+    size_t offset = out->len < out->size ? out->len : out->size;
+    va_list ap;
+    va_start(ap, spec);
+    int written = vsnprintf(out->size ? out->buf + offset : NULL, out->size - offset, spec, ap);
+    va_end(ap);
+    if (written > 0)
+        out->len += (size_t)written;
+}
+
+static long long as_signed(char type, trace_arg_t arg)
+{
+    switch (type)
+    {
+    case TRACE_ARG_UINT:
+        return (long long)arg.u;
+    case TRACE_ARG_DOUBLE:
+        return (long long)arg.f;
+    case TRACE_ARG_POINTER:
+        return (long long)arg.p;
+    default:
+        return (long long)arg.i;
+    }
+}
+
+static unsigned long long as_unsigned(char type, trace_arg_t arg)
+{
+    switch (type)
+    {
+    case TRACE_ARG_INT:
+        return (unsigned long long)arg.i;
+    case TRACE_ARG_DOUBLE:
+        return (unsigned long long)arg.f;
+    default:
+        return (unsigned long long)arg.u;
+    }
+}
+
+static double as_double(char type, trace_arg_t arg)
+{
+    switch (type)
+    {
+    case TRACE_ARG_INT:
+        return (double)arg.i;
+    case TRACE_ARG_UINT:
+    case TRACE_ARG_POINTER:
+        return (double)arg.u;
+    default:
+        return arg.f;
+    }
+}
+
+int format_args(char *buf, size_t size, const char *format, const char *arg_types,
+                const trace_arg_t *args, uint32_t arg_count)
+{
+    output_t out = {buf, size, 0};
+    uint32_t next = 0;
+
+    if (size)
+        buf[0] = '\0';
+
+    const char *p = format;
+    while (*p)
+    {
+        const char *percent = strchr(p, '%');
+        if (!percent)
+        {
+            append(&out, "%s", p);
+            break;
+        }
+        if (percent > p)
+            append(&out, "%.*s", (int)(percent - p), p);
+        if (percent[1] == '%')
+        {
+            append(&out, "%%");
+            p = percent + 2;
+            continue;
+        }
+
+        // %[flags][width][.precision][length]conversion, the length is replaced
+        char spec[32];
+        const char *q = percent + 1;
+        q += strspn(q, "-+ #0");
+        q += strspn(q, "0123456789");
+        if (*q == '.')
+        {
+            q++;
+            q += strspn(q, "0123456789");
+        }
+        size_t n = (size_t)(q - percent);
+        while (*q && strchr("hlLqjzt", *q))
+            q++;
+
+        // The format comes from the segment, room is left for "ll", the conversion and
+        // the terminator
+        char conversion = *q;
+        if (!conversion || !strchr("diouxXcfFeEgGaAps", conversion) || next >= arg_count || n > sizeof(spec) - 4)
+        {
+            // Not something we can format (or no argument left), keep it as written
+            append(&out, "%.*s", (int)(q - percent + (conversion != '\0')), percent);
+            p = q + (conversion != '\0');
+            continue;
+        }
+
+        memcpy(spec, percent, n);
+        char type = arg_types[next];
+        trace_arg_t arg = args[next++];
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+            memcpy(spec + n, "lld", 4);
+            append(&out, spec, as_signed(type, arg));
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            append(&out, spec, as_unsigned(type, arg));
+            break;
+        case 'c':
+            memcpy(spec + n, "c", 2);
+            append(&out, spec, (int)as_signed(type, arg));
+            break;
+        case 'p':
+        case 's':
+            memcpy(spec + n, "p", 2);
+            append(&out, spec, (void *)(uintptr_t)arg.p);
+            break;
+        default:
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            append(&out, spec, as_double(type, arg));
+            break;
+        }
+        p = q + 1;
+    }
+
+    return (int)out.len;
+}
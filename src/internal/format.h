@@ -0,0 +1,16 @@
+#ifndef TRACER_FORMAT_H
+#define TRACER_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tracering/event.h"
+
+// Formats TRACE_ARGS values with the callsite's printf-style format, snprintf
+// semantics (returns the full length, truncates to `size`). Each conversion takes the
+// next argument, converted to what the conversion expects, length modifiers in the
+// format are ignored. %s prints the address, strings are not copied by emitters.
+int format_args(char *buf, size_t size, const char *format, const char *arg_types,
+                const trace_arg_t *args, uint32_t arg_count);
+
+#endif // TRACER_FORMAT_H
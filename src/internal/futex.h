@@ -0,0 +1,58 @@
+#ifndef TRACER_FUTEX_H
+#define TRACER_FUTEX_H
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+// Futexes on words of the shared segment, so not FUTEX_PRIVATE_FLAG: waiters and
+// wakers live in different processes.
+
+// Sleeps while *word == expected, at most timeout_ns (0 = no timeout)
+static inline void futex_wait(atomic_uint *word, unsigned int expected, uint64_t timeout_ns)
+{
+    struct timespec ts = {(time_t)(timeout_ns / 1000000000ull), (long)(timeout_ns % 1000000000ull)};
+    syscall(SYS_futex, (unsigned int *)word, FUTEX_WAIT, expected, timeout_ns ? &ts : NULL, NULL, 0);
+}
+
+// Sleeps while each words[i] == expected[i], at most timeout_ns (0 = no timeout). Returns
+// -1 with errno ENOSYS, without sleeping, on kernels without futex_waitv (before 5.16).
+static inline int futex_wait_any(atomic_uint *const *words, const unsigned int *expected, unsigned int count,
+                                 uint64_t timeout_ns)
+{
+#ifdef SYS_futex_waitv
+    struct futex_waitv waiters[FUTEX_WAITV_MAX];
+    if (count > FUTEX_WAITV_MAX)
+        count = FUTEX_WAITV_MAX;
+    for (unsigned int i = 0; i < count; ++i)
+        waiters[i] = (struct futex_waitv){expected[i], (uintptr_t)words[i], FUTEX_32, 0};
+
+    // The timeout is absolute
+    struct timespec ts;
+    if (timeout_ns)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t ns = (uint64_t)ts.tv_nsec + timeout_ns % 1000000000ull;
+        ts.tv_sec += (time_t)(timeout_ns / 1000000000ull + ns / 1000000000ull);
+        ts.tv_nsec = (long)(ns % 1000000000ull);
+    }
+    if (syscall(SYS_futex_waitv, waiters, count, 0, timeout_ns ? &ts : NULL, CLOCK_MONOTONIC) != -1 || errno != ENOSYS)
+        return 0;
+#else
+    (void)words, (void)expected, (void)count, (void)timeout_ns;
+    errno = ENOSYS;
+#endif
+    return -1;
+}
+
+static inline void futex_wake_all(atomic_uint *word)
+{
+    syscall(SYS_futex, (unsigned int *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+#endif // TRACER_FUTEX_H
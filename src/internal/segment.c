@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+
+#include "segment.h"
+#include "buffer.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/magic.h>
+#include <mntent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#define THP_ENABLED "/sys/kernel/mm/transparent_hugepage/enabled"             // anonymous memory
+#define THP_SHMEM_ENABLED "/sys/kernel/mm/transparent_hugepage/shmem_enabled" // shm_open segments
+
+// Path of the segment in the first hugetlbfs mount, 0 if there is none
+static int hugetlbfs_path(const char *name, char *path, size_t size)
+{
+    FILE *mounts = setmntent("/proc/mounts", "r");
+    if (!mounts)
+        return 0;
+
+    int found = 0;
+    struct mntent *mnt;
+    while (!found && (mnt = getmntent(mounts)) != NULL)
+    {
+        if (strcmp(mnt->mnt_type, "hugetlbfs") == 0)
+            found = snprintf(path, size, "%s%s", mnt->mnt_dir, name) < (int)size;
+    }
+    endmntent(mounts);
+    return found;
+}
+
+static int is_hugetlbfs(int fd)
+{
+    struct statfs fs;
+    return fstatfs(fd, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC;
+}
+
+// Advised memory only gets huge pages if the administrator allowed it for its kind, the
+// active mode is the bracketed one: "always [madvise] never" for anonymous memory,
+// "always within_size [advise] never deny force" for shared memory
+static int thp_enabled(const char *knob)
+{
+    char mode[128];
+    FILE *f = fopen(knob, "r");
+    if (!f)
+        return 0;
+    size_t len = fread(mode, 1, sizeof(mode) - 1, f);
+    fclose(f);
+    mode[len] = '\0';
+
+    return strstr(mode, "[never]") == NULL && strstr(mode, "[deny]") == NULL && strchr(mode, '[') != NULL;
+}
+
+static int create_hugetlbfs(const char *name, size_t *size)
+{
+    char path[PATH_MAX];
+    if (!hugetlbfs_path(name, path, sizeof(path)))
+        return -1;
+
+    int fd = open(path, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+        return -1;
+
+    struct statfs fs;
+    size_t rounded = 0;
+    if (fstatfs(fd, &fs) == 0 && fs.f_bsize > 0)
+        rounded = (*size + fs.f_bsize - 1) / fs.f_bsize * fs.f_bsize;
+
+    // Huge pages are reserved when the file is first mapped, a mapping that fails here
+    // means there aren't enough free, rather than a SIGBUS on first touch later
+    void *probe = MAP_FAILED;
+    if (rounded && ftruncate(fd, 0) == 0 && ftruncate(fd, (off_t)rounded) == 0)
+        probe = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (probe == MAP_FAILED)
+    {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    munmap(probe, rounded);
+
+    *size = rounded;
+    return fd;
+}
+
+const char *segment_session(const char *session)
+{
+    if (!session)
+        session = getenv(TRACE_SESSION_ENV);
+    return session ? session : "";
+}
+
+int segment_name(const char *session, char *name, size_t size)
+{
+    session = segment_session(session);
+    size_t len = strlen(session);
+    if (len >= TRACE_SESSION_NAME_MAX)
+        return -1;
+    for (size_t i = 0; i < len; ++i)
+    {
+        char c = session[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.'))
+            return -1;
+    }
+
+    int written = len ? snprintf(name, size, "%s.%s", TRACE_SHM_NAME, session) : snprintf(name, size, "%s", TRACE_SHM_NAME);
+    return written >= 0 && (size_t)written < size ? 0 : -1;
+}
+
+int segment_create(const char *name, size_t *size, unsigned int flags)
+{
+    // Only one copy may exist, emitters attach to the first one they find
+    if (flags & TRACE_MAP_HUGEPAGES)
+    {
+        int fd = create_hugetlbfs(name, size);
+        if (fd != -1)
+        {
+            shm_unlink(name);
+            return fd;
+        }
+    }
+
+    char path[PATH_MAX];
+    if (hugetlbfs_path(name, path, sizeof(path)))
+        unlink(path);
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+        return -1;
+    // Truncating first discards anything left by a previous receiver, the segment reads as zeros
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, (off_t)*size) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int segment_open(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0666);
+    if (fd != -1)
+        return fd;
+
+    char path[PATH_MAX];
+    if (hugetlbfs_path(name, path, sizeof(path)))
+        fd = open(path, O_RDWR);
+    return fd;
+}
+
+void segment_unlink(const char *name)
+{
+    shm_unlink(name);
+
+    char path[PATH_MAX];
+    if (hugetlbfs_path(name, path, sizeof(path)))
+        unlink(path);
+}
+
+static size_t rings_offset(void)
+{
+    return (sizeof(trace_shm_header_t) + TRACE_CACHE_LINE - 1) & ~(size_t)(TRACE_CACHE_LINE - 1);
+}
+
+size_t segment_size(uint32_t ring_capacity, uint32_t ring_count)
+{
+    return rings_offset() + ring_count * trace_ring_stride(ring_capacity);
+}
+
+void segment_format(trace_shm_header_t *header, size_t size, uint32_t ring_capacity, uint32_t ring_count,
+                    uint32_t payload_max)
+{
+    header->version = TRACE_SHM_VERSION;
+    header->header_size = sizeof(trace_shm_header_t);
+    header->segment_size = size;
+    header->ring_capacity = ring_capacity;
+    header->ring_count = ring_count;
+    header->rings_offset = rings_offset();
+    header->ring_stride = trace_ring_stride(ring_capacity);
+
+    uint32_t fits = trace_payload_fits(ring_capacity);
+    if (payload_max > TRACE_PAYLOAD_MAX)
+        payload_max = TRACE_PAYLOAD_MAX;
+    header->payload_max = payload_max < fits ? payload_max : fits;
+
+    atomic_store_explicit(&header->enable_mask, ~0ull, memory_order_relaxed); // everything enabled
+
+    memcpy(header->strtab, "?", 2);
+    atomic_store_explicit(&header->strtab_used, 2, memory_order_relaxed);
+    atomic_store_explicit(&header->callsite_count, 1, memory_order_relaxed);
+}
+
+unsigned int segment_prepare(int fd, void *addr, size_t size, unsigned int flags)
+{
+    unsigned int obtained = 0;
+
+    if (fd != -1 && is_hugetlbfs(fd))
+        obtained |= TRACE_MAP_HUGETLB;
+    else if ((flags & TRACE_MAP_HUGEPAGES) && madvise(addr, size, MADV_HUGEPAGE) == 0 &&
+             thp_enabled(fd == -1 ? THP_ENABLED : THP_SHMEM_ENABLED))
+        obtained |= TRACE_MAP_THP;
+
+    // Prefault after the huge page advice so the faults allocate huge pages. A read
+    // would only map the zero page of anonymous memory, the fallback writes each page
+    // with an atomic add of 0: the segment may already be in use.
+    if (flags & TRACE_MAP_POPULATE)
+    {
+#ifdef MADV_POPULATE_WRITE
+        if (madvise(addr, size, MADV_POPULATE_WRITE) == 0)
+            obtained |= TRACE_MAP_POPULATE;
+#endif
+        if (!(obtained & TRACE_MAP_POPULATE))
+        {
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            for (size_t offset = 0; offset < size; offset += page)
+                __atomic_fetch_add((char *)addr + offset, 0, __ATOMIC_RELAXED);
+            obtained |= TRACE_MAP_POPULATE;
+        }
+    }
+
+    if ((flags & TRACE_MAP_LOCK) && mlock(addr, size) == 0)
+        obtained |= TRACE_MAP_LOCK;
+
+    return obtained;
+}
@@ -0,0 +1,41 @@
+#ifndef TRACER_SEGMENT_H
+#define TRACER_SEGMENT_H
+
+#include <stddef.h>
+
+#include "tracering/mapping.h"
+#include "buffer.h"
+
+// The shared segment is a POSIX shared memory object on tmpfs, or a file of the same
+// name in a hugetlbfs mount when the receiver asked for huge pages and some are free.
+// Emitters look for it in that order.
+
+// Session an emitter or receiver uses: `session`, else $TRACERING_SESSION, else "" for
+// the default session
+const char *segment_session(const char *session);
+
+// Shared memory name of a session's segment, TRACE_SHM_NAME for the default session and
+// TRACE_SHM_NAME ".<session>" for the others. Returns 0, -1 if the session name is invalid.
+int segment_name(const char *session, char *name, size_t size);
+
+// Creates the segment, replacing any left by a previous receiver. `size` is rounded up
+// to the page size of the filesystem it ends up on. Returns the fd or -1.
+int segment_create(const char *name, size_t *size, unsigned int flags);
+int segment_open(const char *name); // returns the fd or -1
+void segment_unlink(const char *name);
+
+// Size of a segment with this ring geometry, before rounding to the page size
+size_t segment_size(uint32_t ring_capacity, uint32_t ring_count);
+
+// Writes the layout, an empty callsite table and an all-enabled mask into a zeroed
+// segment. `payload_max` is capped to TRACE_PAYLOAD_MAX and to what fits in half a ring.
+// Clock, backpressure and the magic are left to the caller.
+void segment_format(trace_shm_header_t *header, size_t size, uint32_t ring_capacity, uint32_t ring_count,
+                    uint32_t payload_max);
+
+// Applies TRACE_MAP_* flags to a mapping of the segment, returns the obtained flags.
+// `fd` is the segment's file, -1 for an anonymous private mapping (flight recorder):
+// transparent huge pages are governed by a different sysfs knob for each.
+unsigned int segment_prepare(int fd, void *addr, size_t size, unsigned int flags);
+
+#endif // TRACER_SEGMENT_H
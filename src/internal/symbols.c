@@ -0,0 +1,211 @@
+#define _POSIX_C_SOURCE 200809L // strdup()
+
+#include "symbols.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct
+{
+    uint64_t address;
+    uint64_t size;
+    const char *name; // points into the mapped file
+} symbol_t;
+
+// Addresses without a symbol, formatted once
+typedef struct
+{
+    uint64_t offset;
+    char *name;
+} unknown_t;
+
+typedef struct elf_file
+{
+    struct elf_file *next;
+    char *path;
+    void *map; // NULL if the file couldn't be read
+    size_t map_size;
+    symbol_t *symbols; // sorted by address
+    size_t symbol_count;
+    unknown_t *unknown; // sorted by offset
+    size_t unknown_count;
+} elf_file_t;
+
+static elf_file_t *files = NULL;
+static pthread_mutex_t symbols_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int compare_symbols(const void *a, const void *b)
+{
+    const symbol_t *x = a, *y = b;
+    return x->address < y->address ? -1 : x->address > y->address;
+}
+
+// Collects the function symbols of .symtab, or of .dynsym for stripped files
+static void read_symbols(elf_file_t *file)
+{
+    const unsigned char *data = file->map;
+    const Elf64_Ehdr *ehdr = file->map;
+    if (file->map_size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_shentsize != sizeof(Elf64_Shdr) ||
+        ehdr->e_shoff + (uint64_t)ehdr->e_shnum * sizeof(Elf64_Shdr) > file->map_size)
+        return;
+
+    const Elf64_Shdr *shdrs = (const Elf64_Shdr *)(data + ehdr->e_shoff);
+    const Elf64_Shdr *table = NULL;
+    for (int i = 0; i < ehdr->e_shnum; ++i)
+    {
+        if (shdrs[i].sh_type == SHT_SYMTAB || (shdrs[i].sh_type == SHT_DYNSYM && !table))
+            table = &shdrs[i];
+    }
+    if (!table || table->sh_link >= ehdr->e_shnum || table->sh_offset + table->sh_size > file->map_size)
+        return;
+
+    const Elf64_Shdr *strtab = &shdrs[table->sh_link];
+    if (strtab->sh_offset + strtab->sh_size > file->map_size)
+        return;
+
+    const Elf64_Sym *syms = (const Elf64_Sym *)(data + table->sh_offset);
+    size_t count = table->sh_size / sizeof(Elf64_Sym);
+    file->symbols = malloc(count * sizeof(symbol_t));
+    if (!file->symbols)
+        return;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        int type = ELF64_ST_TYPE(syms[i].st_info);
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) || syms[i].st_shndx == SHN_UNDEF || syms[i].st_value == 0 ||
+            syms[i].st_name >= strtab->sh_size)
+            continue;
+        file->symbols[file->symbol_count++] = (symbol_t){
+            syms[i].st_value, syms[i].st_size, (const char *)data + strtab->sh_offset + syms[i].st_name};
+    }
+    qsort(file->symbols, file->symbol_count, sizeof(symbol_t), compare_symbols);
+}
+
+static elf_file_t *open_file(const char *path)
+{
+    for (elf_file_t *file = files; file; file = file->next)
+    {
+        if (strcmp(file->path, path) == 0)
+            return file;
+    }
+
+    elf_file_t *file = calloc(1, sizeof(elf_file_t));
+    if (!file || !(file->path = strdup(path)))
+    {
+        free(file);
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd != -1 && fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        file->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file->map == MAP_FAILED)
+            file->map = NULL;
+        else
+            file->map_size = (size_t)st.st_size;
+    }
+    if (fd != -1)
+        close(fd);
+    if (file->map)
+        read_symbols(file);
+
+    file->next = files;
+    files = file;
+    return file;
+}
+
+static const char *find_symbol(const elf_file_t *file, uint64_t offset)
+{
+    // Last symbol starting at or before the offset
+    size_t lo = 0, hi = file->symbol_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (file->symbols[mid].address <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+
+    const symbol_t *symbol = &file->symbols[lo - 1];
+    if (symbol->size && offset >= symbol->address + symbol->size)
+        return NULL;
+    return symbol->name;
+}
+
+static const char *unknown_name(elf_file_t *file, uint64_t offset)
+{
+    size_t lo = 0, hi = file->unknown_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (file->unknown[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < file->unknown_count && file->unknown[lo].offset == offset)
+        return file->unknown[lo].name;
+
+    const char *base = strrchr(file->path, '/');
+    base = base ? base + 1 : file->path;
+    char text[256];
+    snprintf(text, sizeof(text), "%s+0x%llx", base, (unsigned long long)offset);
+
+    unknown_t *unknown = realloc(file->unknown, (file->unknown_count + 1) * sizeof(unknown_t));
+    char *name = strdup(text);
+    if (!unknown || !name)
+    {
+        if (unknown)
+            file->unknown = unknown;
+        free(name);
+        return "?";
+    }
+    file->unknown = unknown;
+    memmove(&unknown[lo + 1], &unknown[lo], (file->unknown_count - lo) * sizeof(unknown_t));
+    unknown[lo] = (unknown_t){offset, name};
+    file->unknown_count++;
+    return name;
+}
+
+const char *symbols_lookup(const char *path, uint64_t offset)
+{
+    pthread_mutex_lock(&symbols_mutex);
+    elf_file_t *file = open_file(path);
+    const char *name = file ? find_symbol(file, offset) : "?";
+    if (!name)
+        name = unknown_name(file, offset);
+    pthread_mutex_unlock(&symbols_mutex);
+    return name;
+}
+
+void symbols_clear(void)
+{
+    pthread_mutex_lock(&symbols_mutex);
+    while (files)
+    {
+        elf_file_t *file = files;
+        files = file->next;
+        if (file->map)
+            munmap(file->map, file->map_size);
+        for (size_t i = 0; i < file->unknown_count; ++i)
+            free(file->unknown[i].name);
+        free(file->unknown);
+        free(file->symbols);
+        free(file->path);
+        free(file);
+    }
+    pthread_mutex_unlock(&symbols_mutex);
+}
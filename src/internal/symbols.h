@@ -0,0 +1,13 @@
+#ifndef TRACER_SYMBOLS_H
+#define TRACER_SYMBOLS_H
+
+#include <stdint.h>
+
+// Name of the function at `offset` (relative to the load address) in the ELF file at
+// `path`. Symbol tables are read once per file and kept, "path+0x..." is returned when
+// the file or the symbol can't be found. Strings stay valid until symbols_clear().
+const char *symbols_lookup(const char *path, uint64_t offset);
+
+void symbols_clear(void);
+
+#endif // TRACER_SYMBOLS_H
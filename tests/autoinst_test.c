@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L // for nanosleep
+#include <time.h>
+#include <stdio.h>
+
+#include <pthread.h>
+
+#include <tracering/tracering.h>
+#include <tracering/autoinst.h>
+
+// Built with -finstrument-functions: every function below emits its own begin/end
+// events, run ./build/stack_trace_test to see them with their names. Calls shorter
+// than MIN_DURATION_NS (the innermost recurse() calls) are filtered out by the emitter.
+
+#define NUM_THREADS 2
+#define MIN_DURATION_NS 300000
+
+static void sleep_us(long us)
+{
+    struct timespec ts = {0, us * 1000};
+    nanosleep(&ts, NULL);
+}
+
+// Excluded by name below
+void log_progress(int step)
+{
+    (void)step;
+    sleep_us(100);
+}
+
+static int tokenize(int n)
+{
+    sleep_us(500);
+    return n * 2;
+}
+
+static int parse(int n)
+{
+    int tokens = tokenize(n);
+    sleep_us(1000);
+    return tokens + 1;
+}
+
+static int recurse(int depth)
+{
+    sleep_us(200);
+    return depth ? recurse(depth - 1) + 1 : 0;
+}
+
+static void *worker_thread(void *arg)
+{
+    int worker = *(int *)arg;
+    for (int i = 0; i < 3; ++i)
+    {
+        parse(worker + i);
+        log_progress(i);
+    }
+    recurse(3);
+    return NULL;
+}
+
+int main(void)
+{
+    const char *exclude[] = {"log_*"};
+    tracer_autoinst_config_t config = TRACER_AUTOINST_CONFIG_DEFAULT;
+    config.exclude = exclude;
+    config.exclude_count = 1;
+    tracer_autoinst_config(&config);
+
+    tracer_emit_config_t emit_config = TRACER_EMIT_CONFIG_DEFAULT;
+    emit_config.min_duration_ns = MIN_DURATION_NS;
+    if (tracer_emit_init_config(&emit_config) != 0)
+    {
+        fprintf(stderr, "Failed to initialize tracer emitter\n");
+        return 1;
+    }
+
+    pthread_t threads[NUM_THREADS];
+    int thread_ids[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; ++i)
+    {
+        thread_ids[i] = i;
+        pthread_create(&threads[i], NULL, worker_thread, &thread_ids[i]);
+    }
+    for (int i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+
+    tracer_emit_shutdown();
+    printf("Autoinst test complete\n");
+    return 0;
+}
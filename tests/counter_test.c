@@ -0,0 +1,74 @@
+#include <unistd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <tracering/receiver.h>
+#include <tracering/adapter/counter.h>
+
+#define SERIES_MAX 16
+
+void handle_signal(int sig)
+{
+    (void)sig;
+    tracer_receiver_stop();
+}
+
+void counter_sample_handler(const trace_counter_sample_t *sample)
+{
+    printf("%-7s %-20s = %10.2f (%+.2f) at %lu\n",
+           sample->kind == TRACE_VALUE_COUNTER ? "COUNTER" : "GAUGE",
+           sample->name, sample->value, sample->delta, sample->timestamp);
+    fflush(stdout);
+}
+
+// Last buckets of every counter, min/max/last per 100ms
+static void print_series(void)
+{
+    for (uint32_t id = 0; id < tracer_adapter_counter_count(); ++id)
+    {
+        trace_counter_info_t info;
+        if (tracer_adapter_counter_info(id, &info) != 0)
+            continue;
+
+        printf("%s: %.2f after %lu samples\n", info.name, info.value, info.samples);
+
+        trace_counter_bucket_t buckets[SERIES_MAX];
+        uint32_t count = tracer_adapter_counter_series(id, buckets, SERIES_MAX);
+        for (uint32_t i = 0; i < count; ++i)
+            printf("  %lu: min %.2f max %.2f last %.2f (%u samples)\n", buckets[i].start_timestamp,
+                   buckets[i].min, buckets[i].max, buckets[i].last, buckets[i].samples);
+    }
+}
+
+int main(void)
+{
+    printf("Starting counter test...\n");
+
+    // Register signal handlers
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    tracer_receiver_init();
+
+    tracer_counter_config_t config = TRACER_COUNTER_CONFIG_DEFAULT;
+    config.bucket_ns = 100000000;
+    if (tracer_adapter_counter_init_config(&config) != 0)
+    {
+        fprintf(stderr, "Failed to initialize counter adapter\n");
+        return 1;
+    }
+
+    tracer_adapter_counter_register_handler(counter_sample_handler);
+
+    tracer_receiver_run(); // until SIGINT/SIGTERM
+
+    print_series();
+
+    tracer_adapter_counter_shutdown();
+    tracer_receiver_shutdown();
+
+    printf("Counter test completed\n");
+    return 0;
+}
@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include <tracering/tracering.h>
+
+// Measures the per-event emit cost with many hot threads, with and without
+// per-thread batching. A receiver runs in-process and drains the ring so the
+// emitters are measured against a live consumer, not a full buffer. Before it
+// starts, measures the ring space an event takes by filling a thread's ring.
+
+#define EVENTS_PER_THREAD 200000
+
+static atomic_bool receiving = 1;
+static atomic_bool receiver_sleeps = 0; // sleeps in tracer_receiver_wait() whenever idle
+static unsigned int batch_size = 0;
+static uint32_t ring_capacity = 0;
+
+// Thread CPU time, so time spent descheduled doesn't count as emit cost
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *receiver_thread(void *arg)
+{
+    (void)arg;
+    while (atomic_load(&receiving))
+    {
+        if (atomic_load(&receiver_sleeps))
+            tracer_receiver_wait(1000000);
+        else
+            tracer_receiver_poll();
+    }
+    return NULL;
+}
+
+static void *worker_thread(void *arg)
+{
+    uint64_t *elapsed = arg;
+
+    tracer_emit_set_batch_size(batch_size);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < EVENTS_PER_THREAD; ++i)
+    {
+        TRACE_NOTIFY(BenchEvent);
+    }
+    tracer_flush();
+    *elapsed = now_ns() - start;
+
+    return NULL;
+}
+
+// Emits events of one shape until the thread's ring is full, nothing drains it yet
+static void *fill_thread(void *arg)
+{
+    const int *with_args = arg;
+    for (uint32_t i = 0; i < ring_capacity; ++i)
+    {
+        if (*with_args)
+            TRACE_ARGS(BenchArgs, "%u %u", i, i + 1);
+        else
+            TRACE_NOTIFY(BenchEvent);
+    }
+    tracer_flush();
+    return NULL;
+}
+
+// Ring bytes per event: a fresh ring over the events that fit in it
+static double fill_bytes(int with_args)
+{
+    trace_thread_stats_t before, after;
+    tracer_receiver_stats(&before);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, fill_thread, &with_args);
+    pthread_join(thread, NULL);
+
+    tracer_receiver_stats(&after);
+    return (double)ring_capacity * sizeof(uint64_t) / (double)(after.emitted - before.emitted);
+}
+
+typedef struct
+{
+    double ns;     // emit cost per event
+    double writes; // ring index stores per event, counted by the emitters
+} bench_result_t;
+
+static bench_result_t run(unsigned int num_threads)
+{
+    pthread_t threads[num_threads];
+    uint64_t elapsed[num_threads];
+
+    // Worker entries are recycled once the receiver has drained them, whose counters are
+    // then kept in its totals: take the difference of the totals around the run
+    trace_thread_stats_t before, after;
+    tracer_receiver_stats(&before);
+
+    for (unsigned int i = 0; i < num_threads; ++i)
+        pthread_create(&threads[i], NULL, worker_thread, &elapsed[i]);
+
+    uint64_t total = 0;
+    for (unsigned int i = 0; i < num_threads; ++i)
+    {
+        pthread_join(threads[i], NULL);
+        total += elapsed[i];
+    }
+
+    tracer_receiver_stats(&after);
+    uint64_t emitted = after.emitted - before.emitted;
+    bench_result_t result;
+    result.ns = (double)total / ((double)num_threads * EVENTS_PER_THREAD);
+    result.writes = emitted ? (double)(after.index_writes - before.index_writes) / (double)emitted : 0.0;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int max_threads = argc > 1 ? (unsigned int)atoi(argv[1]) : 32;
+    const unsigned int batch_sizes[] = {0, 8, 32, TRACER_BATCH_MAX};
+
+    tracer_receiver_config_t config = TRACER_RECEIVER_CONFIG_DEFAULT;
+    config.wait_spin_ns = 0;
+    tracer_receiver_init_config(&config);
+    ring_capacity = config.ring_capacity;
+    if (tracer_emit_init() != 0)
+    {
+        fprintf(stderr, "Failed to initialize tracer emitter\n");
+        return 1;
+    }
+
+    // Each record carries the 24-byte event base compacted, arguments only when present
+    printf("ring bytes/event: %.1f bare, %.1f with 2 args (trace_event_t: %zu bytes)\n\n", fill_bytes(0), fill_bytes(1),
+           sizeof(trace_event_t));
+
+    pthread_t receiver_tid;
+    pthread_create(&receiver_tid, NULL, receiver_thread, NULL);
+
+    // Each thread publishes to its own ring with a release store of its write index,
+    // once per event without batching, once per batch with it. Threads that don't get
+    // their own ring also do a fetch_add on the shared ring's cache line. With a receiver
+    // that sleeps whenever it is idle, publishes also pay for waking it up.
+    printf("%8s %8s %12s %18s %22s\n", "threads", "batch", "ns/event", "sleeping receiver", "index writes/evt");
+    for (unsigned int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); ++b)
+        {
+            batch_size = batch_sizes[b];
+            bench_result_t polling = run(threads);
+            atomic_store(&receiver_sleeps, 1);
+            bench_result_t sleeping = run(threads);
+            atomic_store(&receiver_sleeps, 0);
+            printf("%8u %8u %12.1f %18.1f %22.3f\n", threads, batch_size, polling.ns, sleeping.ns, polling.writes);
+        }
+    }
+
+    // An instrumented site while tracing is switched off at runtime
+    tracer_receiver_set_enabled(0);
+    batch_size = 0;
+    bench_result_t disabled = run(1);
+    printf("%8u %8s %12.1f %18s %22.3f\n", 1, "disabled", disabled.ns, "", disabled.writes);
+
+    atomic_store(&receiving, 0);
+    pthread_join(receiver_tid, NULL);
+
+    tracer_emit_shutdown();
+    tracer_receiver_shutdown();
+    return 0;
+}
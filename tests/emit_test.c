@@ -5,13 +5,15 @@
 #include <stdlib.h>
 
 #include <pthread.h>
+#include <stdatomic.h>
 
-#define TRACER_ALLOW_OVERWRITE 0
 #include <tracering/tracering.h>
 
 #define NUM_THREADS 4
 #define EVENTS_PER_THREAD 10
 
+static atomic_int active_workers = 0;
+
 #define SLEEP_NS(ns)                  \
     do                                \
     {                                 \
@@ -19,17 +21,37 @@
         nanosleep(&ts, NULL);         \
     } while (0)
 
+// Identifies a worker's flow, unique across emitting processes
+static uint64_t worker_flow_id(int worker)
+{
+    return (uint64_t)getpid() << 32 | (uint32_t)worker;
+}
+
 void *worker_thread(void *arg)
 {
-    (void)arg; // Unused argument
+    int worker = *(int *)arg;
+    TRACE_FLOW_STEP(WorkerStart, worker_flow_id(worker));
+    TRACE_GAUGE(ActiveWorkers, atomic_fetch_add(&active_workers, 1) + 1);
+
+    char query[128];
+    snprintf(query, sizeof(query), "SELECT id, payload FROM work_items WHERE worker = %d ORDER BY id LIMIT %d",
+             worker, EVENTS_PER_THREAD);
+    // Runtime label, interned once per tenant: workers 0 and 2 share Tenant0
+    char tenant[32];
+    snprintf(tenant, sizeof(tenant), "Tenant%d", worker % 2);
+    TRACE_INTERNED(tracer_intern(tenant), { TRACE_STRING(Query, query); });
+
     TRACE(WorkerOuter, {
         for (int i = 0; i < EVENTS_PER_THREAD; ++i)
         {
             TRACE(WorkerInner, {
                 SLEEP_NS(100000000); // Simulate 100ms of work
             });
+            TRACE_COUNTER(WorkItems, 1);
         }
     });
+    TRACE_GAUGE(ActiveWorkers, atomic_fetch_sub(&active_workers, 1) - 1);
+    TRACE_FLOW_END(WorkerDone, worker_flow_id(worker));
 
     return NULL;
 }
@@ -50,6 +72,7 @@ int main(void)
             for (int i = 0; i < NUM_THREADS; ++i)
             {
                 thread_ids[i] = i;
+                TRACE_FLOW_BEGIN(SpawnWorker, worker_flow_id(i));
                 if (pthread_create(&threads[i], NULL, worker_thread, &thread_ids[i]) != 0)
                 {
                     perror("pthread_create");
@@ -66,6 +89,8 @@ int main(void)
         });
     });
 
+    TRACE_ARGS(EmitDone, "%d threads, %d events each", NUM_THREADS, EVENTS_PER_THREAD);
+
     tracer_emit_shutdown();
 
     printf("Emit test completed\n");
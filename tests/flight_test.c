@@ -0,0 +1,77 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <tracering/tracering.h>
+
+// Runs without a receiver: events go to the in-process flight recorder, which keeps the
+// last FLIGHT_CAPACITY units of them per ring. The recorder is dumped at the end, or by the
+// SIGSEGV handler when run with "crash". Read the dump with ./build/receive_test <file>.
+
+#define NUM_THREADS 4
+#define ITERATIONS 1000
+#define FLIGHT_CAPACITY 1024
+#define FLIGHT_PATH "flight_test.flight"
+
+static void *worker_thread(void *arg)
+{
+    int worker = *(int *)arg;
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        TRACE(Request, {
+            TRACE_COUNTER(Requests, 1);
+            TRACE_GAUGE(LastItem, worker * ITERATIONS + i);
+        });
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int crash = argc > 1 && strcmp(argv[1], "crash") == 0;
+
+    tracer_emit_config_t config = TRACER_EMIT_CONFIG_DEFAULT;
+    config.flight_capacity = FLIGHT_CAPACITY;
+    config.flight_path = FLIGHT_PATH;
+    config.flight_signal = SIGUSR2; // kill -USR2 <pid> dumps at any time
+    if (tracer_emit_init_config(&config) != 0)
+    {
+        fprintf(stderr, "Failed to initialize tracer emitter\n");
+        return 1;
+    }
+    if (!tracer_emit_flight())
+        printf("A receiver is running, events go to it instead of the flight recorder\n");
+
+    pthread_t threads[NUM_THREADS];
+    int thread_ids[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; ++i)
+    {
+        thread_ids[i] = i;
+        pthread_create(&threads[i], NULL, worker_thread, &thread_ids[i]);
+    }
+    for (int i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+
+    if (crash)
+    {
+        TRACE(Crash, {
+            printf("Crashing, the flight recorder is dumped to %s\n", FLIGHT_PATH);
+            fflush(stdout);
+            *(volatile int *)0 = 0;
+        });
+    }
+
+    if (tracer_emit_flight())
+    {
+        if (tracer_flight_dump(NULL) == 0)
+            printf("Flight recorder dumped to %s\n", FLIGHT_PATH);
+        else
+            perror("tracer_flight_dump");
+    }
+
+    tracer_emit_shutdown();
+    printf("Flight test complete\n");
+    return 0;
+}
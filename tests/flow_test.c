@@ -0,0 +1,54 @@
+#include <unistd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <tracering/receiver.h>
+#include <tracering/adapter/flow.h>
+
+void handle_signal(int sig)
+{
+    (void)sig;
+    tracer_receiver_stop();
+}
+
+void trace_flow_handler(const trace_flow_t *flow)
+{
+    printf("FLOW %016lx: %s [%u/%u] -> %s [%u/%u] -> %s [%u/%u] | Queued: %7.3f ms | Ran: %8.3f ms | Steps: %u\n",
+           (unsigned long)flow->id,
+           flow->begin_label, flow->begin_pid, flow->begin_thread_id,
+           flow->start_label, flow->start_pid, flow->start_thread_id,
+           flow->end_label, flow->end_pid, flow->end_thread_id,
+           (double)flow->queue_ns / 1000000.0, (double)flow->run_ns / 1000000.0, flow->steps);
+    fflush(stdout);
+}
+
+int main(void)
+{
+    printf("Starting flow test...\n");
+
+    // Register signal handlers
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    tracer_receiver_init();
+
+    if (tracer_adapter_flow_init() != 0)
+    {
+        fprintf(stderr, "Failed to initialize flow adapter\n");
+        return 1;
+    }
+
+    tracer_adapter_flow_register_handler(trace_flow_handler);
+
+    tracer_receiver_run(); // until SIGINT/SIGTERM
+    tracer_adapter_flow_flush();
+
+    printf("Pending flows: %u, lost: %lu\n", tracer_adapter_flow_pending(), (unsigned long)tracer_adapter_flow_lost());
+
+    tracer_adapter_flow_shutdown();
+    tracer_receiver_shutdown();
+
+    printf("Flow test completed\n");
+    return 0;
+}
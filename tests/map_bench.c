@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <pthread.h>
+
+#include <tracering/tracering.h>
+
+// Measures emit latency on the first pass over a large, freshly created ring, where
+// every new page costs a fault, for each segment mapping option. Nothing drains the
+// ring, the thread emits into its own ring until about half of it has been touched
+// (2 units per event, one full timestamp per directory block).
+
+#define RING_CAPACITY (1u << 20)
+#define EVENTS (RING_CAPACITY / 4)
+
+typedef struct
+{
+    double mean_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+    long faults;
+} result_t;
+
+static uint32_t latencies[EVENTS];
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static long thread_faults(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void *worker_thread(void *arg)
+{
+    result_t *result = arg;
+
+    TRACE_NOTIFY(Warmup); // registers the thread and the callsite outside the measurement
+
+    long faults = thread_faults();
+    uint64_t total = 0;
+    for (unsigned int i = 0; i < EVENTS; ++i)
+    {
+        uint64_t start = now_ns();
+        TRACE_NOTIFY(FirstTouch);
+        uint64_t elapsed = now_ns() - start;
+        latencies[i] = (uint32_t)elapsed;
+        total += elapsed;
+    }
+    result->faults = thread_faults() - faults;
+
+    qsort(latencies, EVENTS, sizeof(latencies[0]), compare_u32);
+    result->mean_ns = (double)total / EVENTS;
+    result->p99_ns = latencies[EVENTS * 99 / 100];
+    result->max_ns = latencies[EVENTS - 1];
+    return NULL;
+}
+
+static void format_flags(unsigned int flags, char *buf, size_t size)
+{
+    snprintf(buf, size, "%s%s%s%s%s%s",
+             flags & TRACE_MAP_HUGEPAGES ? "hugepages " : "",
+             flags & TRACE_MAP_HUGETLB ? "hugetlb " : "",
+             flags & TRACE_MAP_THP ? "thp " : "",
+             flags & TRACE_MAP_POPULATE ? "populate " : "",
+             flags & TRACE_MAP_LOCK ? "lock " : "",
+             flags ? "" : "default");
+}
+
+int main(void)
+{
+    const unsigned int modes[] = {
+        TRACE_MAP_DEFAULT,
+        TRACE_MAP_POPULATE,
+        TRACE_MAP_HUGEPAGES | TRACE_MAP_POPULATE,
+        TRACE_MAP_HUGEPAGES | TRACE_MAP_POPULATE | TRACE_MAP_LOCK,
+    };
+
+    printf("%-26s %-26s %10s %10s %10s %10s\n", "requested", "obtained (emitter)", "mean ns", "p99 ns", "max ns", "faults");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+    {
+        tracer_receiver_config_t receiver_config = TRACER_RECEIVER_CONFIG_DEFAULT;
+        receiver_config.ring_capacity = RING_CAPACITY;
+        receiver_config.ring_count = 2; // the shared ring and the worker's own ring
+        receiver_config.map_flags = modes[m];
+        tracer_receiver_init_config(&receiver_config);
+
+        tracer_emit_config_t emit_config = TRACER_EMIT_CONFIG_DEFAULT;
+        emit_config.map_flags = modes[m];
+        if (tracer_emit_init_config(&emit_config) != 0)
+        {
+            fprintf(stderr, "Failed to initialize tracer emitter\n");
+            return 1;
+        }
+
+        result_t result;
+        pthread_t worker;
+        pthread_create(&worker, NULL, worker_thread, &result);
+        pthread_join(worker, NULL);
+
+        char requested[64], obtained[64];
+        format_flags(modes[m], requested, sizeof(requested));
+        format_flags(tracer_emit_mapping(), obtained, sizeof(obtained));
+        printf("%-26s %-26s %10.1f %10lu %10lu %10ld\n", requested, obtained,
+               result.mean_ns, (unsigned long)result.p99_ns, (unsigned long)result.max_ns, result.faults);
+
+        tracer_emit_shutdown();
+        tracer_receiver_shutdown();
+    }
+
+    return 0;
+}
@@ -1,49 +1,108 @@
-#define _POSIX_C_SOURCE 200809L // for nanosleep
-#include <time.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdatomic.h>
 
 #include <tracering/receiver.h>
 
-#define SLEEP_NS(ns)                  \
-    do                                \
-    {                                 \
-        struct timespec ts = {0, ns}; \
-        nanosleep(&ts, NULL);         \
-    } while (0)
-
-static volatile sig_atomic_t keep_running = 1;
-
 void handle_signal(int sig)
 {
     (void)sig;
-    keep_running = 0;
+    tracer_receiver_stop();
 }
 
 void trace_event_handler(const trace_event_t *event)
 {
-    printf("Received event: %s (timestamp: %lu, thread_id: %u)\n",
-           event->data, event->timestamp, event->thread_id);
+    trace_thread_t thread = {0};
+    tracer_receiver_event_thread(event, &thread);
+
+    if (event->kind == TRACE_EVENT_GAP)
+    {
+        printf("Gap: up to %lu events (%lu ring units) of thread %u overwritten before being read\n",
+               (unsigned long)event->args[0].u, (unsigned long)event->args[1].u, thread.tid);
+        fflush(stdout);
+        return;
+    }
+
+    // TRACE_ARGS events come with their formatted arguments, TRACE_DATA ones with a payload
+    char args[128] = "";
+    uint32_t payload_size;
+    const char *payload = tracer_receiver_payload(event, &payload_size);
+    if (payload)
+        snprintf(args, sizeof(args), ": %.*s", (int)payload_size, payload);
+    else if (tracer_receiver_format(event, args + 2, sizeof(args) - 2) >= 0)
+        memcpy(args, ": ", 2);
+
+    // Tag events with their session when watching several
+    char session[TRACE_SESSION_NAME_MAX + 3] = "";
+    if (tracer_receiver_session_count() > 1)
+    {
+        const char *name = tracer_receiver_session_name(event->session);
+        snprintf(session, sizeof(session), "[%s] ", name[0] ? name : "default");
+    }
+
+    printf("%sReceived event: %s%s (timestamp: %lu, thread: %u/%u %s:%s)\n", session,
+           tracer_receiver_event_label(event), args, event->timestamp,
+           thread.pid, thread.tid,
+           thread.process_name ? thread.process_name : "?",
+           thread.name ? thread.name : "?");
     fflush(stdout);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
     // Register signal handlers
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
 
-    tracer_receiver_init();
-    tracer_receiver_register_handler(trace_event_handler);
+    // Optional clock source: monotonic (default), coarse, tsc or manual. Files ending in
+    // .flight are flight recorder dumps to replay. Any other argument is a session to
+    // watch ("default" for the default one), emitters pick theirs with TRACERING_SESSION=name.
+    tracer_receiver_config_t config = TRACER_RECEIVER_CONFIG_DEFAULT;
+    const char *sessions[TRACE_SESSION_MAX];
+    const char *dumps[TRACE_SESSION_MAX];
+    int session_count = 0, dump_count = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        size_t len = strlen(argv[i]);
+        if (len > 7 && strcmp(argv[i] + len - 7, ".flight") == 0)
+        {
+            if (dump_count < TRACE_SESSION_MAX)
+                dumps[dump_count++] = argv[i];
+        }
+        else if (strcmp(argv[i], "coarse") == 0)
+            config.clock = TRACE_CLOCK_MONOTONIC_COARSE;
+        else if (strcmp(argv[i], "tsc") == 0)
+            config.clock = TRACE_CLOCK_TSC;
+        else if (strcmp(argv[i], "manual") == 0)
+            config.clock = TRACE_CLOCK_MANUAL;
+        else if (session_count < TRACE_SESSION_MAX)
+            sessions[session_count++] = strcmp(argv[i], "default") == 0 ? "" : argv[i];
+    }
 
-    while (keep_running)
+    if (session_count)
+        config.session = sessions[0];
+    tracer_receiver_init_config(&config);
+    for (int i = 1; i < session_count; ++i)
     {
-        tracer_receiver_poll();
-        SLEEP_NS(1000000); // Sleep for 1ms
+        if (tracer_receiver_add_session(sessions[i]) == -1)
+            fprintf(stderr, "Could not create session %s\n", sessions[i]);
     }
+    for (int i = 0; i < dump_count; ++i)
+    {
+        if (tracer_receiver_add_dump(dumps[i]) == -1)
+            fprintf(stderr, "Could not read flight recorder dump %s\n", dumps[i]);
+    }
+    tracer_receiver_register_handler(trace_event_handler);
+
+    tracer_receiver_run(); // until SIGINT/SIGTERM
+
+    trace_thread_stats_t stats;
+    tracer_receiver_stats(&stats);
+    printf("Emitted: %lu, dropped (ring full): %lu, overwritten: %lu, filtered: %lu\n",
+           stats.emitted, stats.dropped, stats.overwritten, stats.filtered);
 
     tracer_receiver_shutdown();
     return 0;
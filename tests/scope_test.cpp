@@ -0,0 +1,105 @@
+#include <tracering/tracering.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+// tracering::Scope without a receiver: the events go to the flight recorder, which is
+// dumped and read back. Two functions use the same label, each use site must resolve to
+// its own callsite, and every begin must be closed on early returns and exceptions.
+
+using namespace tracering::literals;
+
+#define FLIGHT_PATH "scope_test.flight"
+#define ITERATIONS 100
+
+static int parse_header(int i)
+{
+    TRACERING_SCOPE("Parse"_trace);
+    if (i % 2)
+        return 1; // early return ends the scope
+    return 0;
+}
+
+static int parse_body(int i)
+{
+    TRACERING_SCOPE("Parse"_trace);
+    if (i % 3 == 0)
+        throw std::runtime_error("bad body"); // so does unwinding
+    return parse_header(i);
+}
+
+struct Check
+{
+    std::map<unsigned int, int> lines; // "Parse" begin events per callsite line
+    int depth = 0;
+    int failures = 0;
+};
+
+int main()
+{
+    tracer_emit_config_t config = TRACER_EMIT_CONFIG_DEFAULT;
+    config.flight_capacity = 64 * 1024;
+    config.flight_path = FLIGHT_PATH;
+    if (tracer_emit_init_config(&config) != 0 || !tracer_emit_flight())
+    {
+        fprintf(stderr, "Needs the flight recorder, stop any receiver of the default session\n");
+        return 1;
+    }
+
+    for (int i = 0; i < ITERATIONS; ++i)
+    {
+        TRACERING_SCOPE("Request"_trace);
+        try
+        {
+            parse_body(i);
+        }
+        catch (const std::exception &)
+        {
+        }
+    }
+
+    if (tracer_flight_dump(nullptr) != 0)
+    {
+        perror("tracer_flight_dump");
+        return 1;
+    }
+    tracer_emit_shutdown();
+
+    Check check;
+    tracering::receiver::init();
+    tracering::receiver::register_handler([&check](const trace_event_t *event)
+                                          {
+        trace_callsite_t callsite;
+        if (!tracering::receiver::callsite(*event, callsite))
+            return;
+        check.depth += event->kind == TRACE_EVENT_BEGIN ? 1 : event->kind == TRACE_EVENT_END ? -1 : 0;
+        if (check.depth < 0)
+            ++check.failures;
+        if (event->kind == TRACE_EVENT_BEGIN && strcmp(callsite.label, "Parse") == 0)
+        {
+            ++check.lines[callsite.line];
+            if (!strstr(callsite.function, "parse_"))
+                ++check.failures;
+        } });
+    if (tracering::receiver::add_dump(FLIGHT_PATH) == -1)
+    {
+        fprintf(stderr, "Could not read %s\n", FLIGHT_PATH);
+        return 1;
+    }
+    while (tracering::receiver::wait(100000000))
+        ;
+    tracering::receiver::shutdown();
+
+    // parse_body runs every iteration, parse_header when it doesn't throw
+    int expected_header = ITERATIONS - (ITERATIONS + 2) / 3;
+    bool ok = check.failures == 0 && check.depth == 0 && check.lines.size() == 2;
+    for (const auto &[line, count] : check.lines)
+    {
+        printf("Parse at line %u: %d scopes\n", line, count);
+        ok = ok && (count == ITERATIONS || count == expected_header);
+    }
+    printf("Scope test %s\n", ok ? "passed" : "FAILED");
+    return ok ? 0 : 1;
+}
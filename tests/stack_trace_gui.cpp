@@ -30,6 +30,7 @@ private:
     std::map<uint32_t, std::vector<size_t>> thread_spans; // thread_id -> span indices
     std::vector<uint32_t> thread_ids;
     std::vector<uint32_t> selected_threads;
+    std::map<uint32_t, std::string> thread_names; // thread_id -> "process:thread (pid)"
     std::map<uint32_t, int> thread_colors; // thread_id -> color pair index
 
     bool recording = false;
@@ -79,6 +80,13 @@ public:
             // Assign color to new thread
             int color_idx = thread_ids.size() % color_palette.size();
             thread_colors[data.thread_id] = color_idx + 1; // Color pair 1+
+
+            // Resolve the name once per thread, the registry entry may be reused later
+            trace_thread_t thread;
+            std::string name;
+            if (tracering::receiver::thread(span->session, span->thread_index, thread))
+                name = std::string(thread.process_name) + ":" + thread.name + " (" + std::to_string(thread.pid) + ")";
+            thread_names[data.thread_id] = name;
         }
         thread_spans[data.thread_id].push_back(spans.size() - 1);
 
@@ -98,6 +106,7 @@ public:
     void signal_handler()
     {
         keep_running = false;
+        tracering::receiver::stop();
     }
 
     void start_recording()
@@ -110,6 +119,7 @@ public:
         thread_spans.clear();
         thread_ids.clear();
         thread_colors.clear();
+        thread_names.clear();
         selected_threads.clear();
         recording = true;
 
@@ -178,7 +188,7 @@ public:
                 attron(A_REVERSE);
             }
 
-            mvprintw(y_pos, 2, "[%c] Thread %u", selected ? 'X' : ' ', thread_id);
+            mvprintw(y_pos, 2, "[%c] Thread %u %s", selected ? 'X' : ' ', thread_id, thread_names[thread_id].c_str());
 
             if ((int)i == thread_selection_idx)
             {
@@ -475,10 +485,7 @@ public:
         // Start receiver thread
         std::thread receiver_thread([this]()
                                     {
-            while (keep_running) {
-                tracering::receiver::poll();
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            } });
+            tracering::receiver::run(); });
 
         // Show initial prompt
         clear();
@@ -491,6 +498,7 @@ public:
 
         // Cleanup
         keep_running = false;
+        tracering::receiver::stop();
         receiver_thread.join();
 
         tracering::adapter::stack_trace::shutdown();
@@ -1,5 +1,3 @@
-#define _POSIX_C_SOURCE 200809L // for nanosleep
-#include <time.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdio.h>
@@ -12,26 +10,17 @@
 #define NUM_THREADS 2
 #define EVENTS_PER_THREAD 3
 
-#define SLEEP_NS(ns)                  \
-    do                                \
-    {                                 \
-        struct timespec ts = {0, ns}; \
-        nanosleep(&ts, NULL);         \
-    } while (0)
-
-static volatile sig_atomic_t keep_running = 1;
-
 void handle_signal(int sig)
 {
     (void)sig;
-    keep_running = 0;
+    tracer_receiver_stop();
 }
 
 void trace_span_handler(const trace_span_t *span)
 {
     double duration_ms = (double)(span->end_timestamp - span->start_timestamp) / 1000000.0;
-    printf("SPAN [Thread %5u]: %-35s | Duration: %7.3f ms | Start: %lu | End: %lu\n",
-           span->thread_id, span->full_path, duration_ms,
+    printf("SPAN [Thread %5u/%5u]: %-35s | Duration: %7.3f ms | Start: %lu | End: %lu\n",
+           span->pid, span->thread_id, span->full_path, duration_ms,
            span->start_timestamp, span->end_timestamp);
     fflush(stdout);
 }
@@ -40,12 +29,7 @@ void *receiver_thread(void *arg)
 {
     (void)arg;
 
-    while (keep_running)
-    {
-        tracer_receiver_poll();
-        SLEEP_NS(1000000); // 1ms polling interval
-    }
-
+    tracer_receiver_run(); // until SIGINT/SIGTERM
     return NULL;
 }
 
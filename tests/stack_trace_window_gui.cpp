@@ -43,6 +43,7 @@ private:
     std::map<uint32_t, std::vector<size_t>> thread_spans;
     std::vector<uint32_t> thread_ids;
     std::vector<uint32_t> selected_threads;
+    std::map<uint32_t, std::string> thread_names; // thread_id -> "process:thread (pid)"
     std::map<uint32_t, Color> thread_colors;
 
     bool recording = false;
@@ -129,6 +130,13 @@ public:
             // Assign color to new thread
             int color_idx = thread_ids.size() % color_palette.size();
             thread_colors[data.thread_id] = color_palette[color_idx];
+
+            // Resolve the name once per thread, the registry entry may be reused later
+            trace_thread_t thread;
+            std::string name;
+            if (tracering::receiver::thread(span->session, span->thread_index, thread))
+                name = std::string(thread.process_name) + ":" + thread.name + " (" + std::to_string(thread.pid) + ")";
+            thread_names[data.thread_id] = name;
         }
         thread_spans[data.thread_id].push_back(spans.size() - 1);
 
@@ -148,6 +156,7 @@ public:
     void signal_handler()
     {
         keep_running = false;
+        tracering::receiver::stop();
     }
 
     bool init_sdl()
@@ -260,6 +269,7 @@ public:
         thread_spans.clear();
         thread_ids.clear();
         thread_colors.clear();
+        thread_names.clear();
         selected_threads.clear();
         recording = true;
 
@@ -510,7 +520,7 @@ public:
             }
 
             // Draw thread label
-            std::string label = "Thread " + std::to_string(thread_id);
+            std::string label = "Thread " + std::to_string(thread_id) + " " + thread_names[thread_id];
             draw_text(label, MARGIN + checkbox_size + 10, y_pos + 2, thread_color);
 
             y_pos += 30;
@@ -699,16 +709,14 @@ public:
 
         std::thread receiver_thread([this]()
                                     {
-        while (keep_running) {
-            tracering::receiver::poll();
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        } });
+        tracering::receiver::run(); });
 
         gui_active = true;
         run_gui();
 
         // Clean shutdown
         keep_running = false;
+        tracering::receiver::stop();
         receiver_thread.join();
 
         tracering::adapter::stack_trace::shutdown();